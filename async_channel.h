@@ -0,0 +1,46 @@
+#ifndef _ASYNC_CHANNEL_H_
+#define _ASYNC_CHANNEL_H_
+
+#include "common.h"
+#include "thread_pool.h"
+#include <functional>
+#include <future>
+
+/*
+*  Asynchronous front for a RequestChannel or FinanceRouter. Requests are handed to a
+*  worker thread of the channel's own and sent in the order they were queued, so the
+*  caller can have requests to several servers in flight at once and only waits when it
+*  needs a response. The worker is the only thread that may use the channel while the
+*  AsyncChannel exists; destroying it waits for everything queued.
+*/
+template <class Channel>
+class AsyncChannel {
+public:
+    typedef std::function<void(const Response&)> Callback;
+
+    explicit AsyncChannel(Channel& channel) : channel(channel), worker(1) {}
+
+    // The future yields the response. done, if given, is called with it on the worker
+    // first, so follow-up requests can be queued without waiting for the caller to wake.
+    // The timeout is the channel's, so it runs from when the worker sends the request.
+    std::future<Response> send_request(const Request& req, Callback done = nullptr, int timeout_seconds = 30) {
+        return worker.submit([this, req, done, timeout_seconds] {
+            Response resp = channel.send_request(req, timeout_seconds);
+            if (done) {
+                done(resp);
+            }
+            return resp;
+        });
+    }
+
+    // Queued behind the requests already waiting; failures are counted by the channel
+    void send_oneway(const Request& req) {
+        worker.enqueue([this, req] { channel.send_oneway(req); });
+    }
+
+private:
+    Channel& channel;
+    ThreadPool worker;
+};
+
+#endif
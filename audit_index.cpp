@@ -0,0 +1,175 @@
+#include "audit_index.h"
+#include "audit_record.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+static_assert(sizeof(AuditIndex::Entry) == 32, "index entries are stored as 32-byte records");
+
+AuditIndex::AuditIndex(const string& _log_path, bool _binary_records) :
+    log_path(_log_path), binary_records(_binary_records), fd(-1), num_entries(0) {
+
+    string index_path = log_path + ".idx";
+    fd = open(index_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        perror(("Error opening audit index " + index_path).c_str());
+        return;
+    }
+
+    // Load what earlier runs indexed; a torn last entry from a crash is dropped
+    vector<Entry> chunk(4096);
+    off_t pos = 0;
+    ssize_t n;
+    while ((n = pread(fd, chunk.data(), chunk.size() * sizeof(Entry), pos)) > 0) {
+        size_t count = n / sizeof(Entry);
+        for (size_t i = 0; i < count; i++) {
+            insert(chunk[i]);
+        }
+        pos += count * sizeof(Entry);
+        if ((size_t)n % sizeof(Entry) != 0) {
+            if (ftruncate(fd, pos) < 0) {
+                perror("Failed to drop torn audit index entry");
+            }
+            break;
+        }
+    }
+}
+
+AuditIndex::~AuditIndex() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void AuditIndex::insert(const Entry& entry) {
+    by_user[entry.user_id][entry.timestamp_us / BUCKET_US].push_back(entry);
+    num_entries++;
+}
+
+void AuditIndex::add(const vector<LogWriter::RecordLocation>& batch) {
+    vector<Entry> entries;
+    entries.reserve(batch.size());
+    for (const LogWriter::RecordLocation& loc : batch) {
+        Entry entry = {loc.key.user_id, loc.segment, loc.key.timestamp_us, loc.offset, loc.length, 0};
+        entries.push_back(entry);
+    }
+
+    if (fd >= 0) {
+        size_t bytes = entries.size() * sizeof(Entry);
+        if (write(fd, entries.data(), bytes) != (ssize_t)bytes) {
+            perror("Audit index write failed");
+        }
+    }
+
+    lock_guard<mutex> lock(indexMutex);
+    for (const Entry& entry : entries) {
+        insert(entry);
+    }
+}
+
+size_t AuditIndex::size() const {
+    lock_guard<mutex> lock(indexMutex);
+    return num_entries;
+}
+
+vector<string> AuditIndex::query(int32_t user_id, int64_t from_us, int64_t to_us, size_t limit) {
+    vector<Entry> matches;
+    {
+        lock_guard<mutex> lock(indexMutex);
+        auto user = by_user.find(user_id);
+        if (user == by_user.end()) {
+            return vector<string>();
+        }
+        // Only the buckets overlapping the range are visited
+        for (auto bucket = user->second.lower_bound(from_us / BUCKET_US);
+             bucket != user->second.end() && bucket->first <= to_us / BUCKET_US && matches.size() < limit;
+             ++bucket) {
+            for (const Entry& entry : bucket->second) {
+                if (entry.timestamp_us >= from_us && entry.timestamp_us <= to_us && matches.size() < limit) {
+                    matches.push_back(entry);
+                }
+            }
+        }
+    }
+
+    // Read segment by segment in file order, then hand the records back oldest first
+    vector<string> raw(matches.size());
+    map<uint32_t, vector<pair<const Entry*, string*>>> by_segment;
+    for (size_t i = 0; i < matches.size(); i++) {
+        by_segment[matches[i].segment].push_back(make_pair(&matches[i], &raw[i]));
+    }
+    for (auto& segment : by_segment) {
+        sort(segment.second.begin(), segment.second.end(),
+             [](const pair<const Entry*, string*>& a, const pair<const Entry*, string*>& b) {
+                 return a.first->offset < b.first->offset;
+             });
+        read_segment(segment.first, segment.second);
+    }
+
+    vector<string> lines;
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (!raw[i].empty()) {
+            lines.push_back(to_text(matches[i], raw[i]));
+        }
+    }
+    return lines;
+}
+
+void AuditIndex::read_segment(uint32_t segment, const vector<pair<const Entry*, string*>>& wanted) const {
+    // A segment is still the live file until it has been rotated out, and may be gzipped after
+    string path = LogWriter::segment_name(log_path, segment);
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+        if (stat((path + ".gz").c_str(), &st) == 0) {
+            gzFile gz = gzopen((path + ".gz").c_str(), "rb");
+            if (!gz) {
+                return;
+            }
+            gzbuffer(gz, 1 << 16);
+            for (const auto& w : wanted) {
+                // Seeking forward decompresses up to the record; the segment is passed over once
+                if (gzseek(gz, w.first->offset, SEEK_SET) < 0) {
+                    break;
+                }
+                w.second->resize(w.first->length);
+                int n = gzread(gz, &(*w.second)[0], w.first->length);
+                w.second->resize(n > 0 ? n : 0);
+            }
+            gzclose(gz);
+            return;
+        }
+        path = log_path;
+    }
+
+    int log_fd = open(path.c_str(), O_RDONLY);
+    if (log_fd < 0) {
+        return;
+    }
+    for (const auto& w : wanted) {
+        w.second->resize(w.first->length);
+        ssize_t n = pread(log_fd, &(*w.second)[0], w.first->length, w.first->offset);
+        w.second->resize(n > 0 ? n : 0);
+    }
+    close(log_fd);
+}
+
+string AuditIndex::to_text(const Entry& entry, const string& raw) const {
+    if (binary_records) {
+        AuditRecord rec;
+        if (AuditRecord::decode(raw.data(), raw.size(), rec) == 0) {
+            return AuditRecord::format_timestamp(entry.timestamp_us) + " [corrupt record]";
+        }
+        return rec.to_text();
+    }
+    // Text records carry no timestamp of their own
+    string line = raw;
+    if (!line.empty() && line.back() == '\n') {
+        line.pop_back();
+    }
+    return AuditRecord::format_timestamp(entry.timestamp_us) + " " + line;
+}
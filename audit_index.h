@@ -0,0 +1,56 @@
+#ifndef _AUDIT_INDEX_H_
+#define _AUDIT_INDEX_H_
+
+#include "log_writer.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+/*
+*  Sidecar index over the audit log: user_id -> hour bucket -> record locations.
+*  Entries are appended to <log>.idx as fixed 32-byte records after each batch of the
+*  log has been written, and loaded back on startup. A query reads only the records it
+*  returns: pread on plain files, and a single forward pass through a gzipped segment.
+*/
+class AuditIndex {
+public:
+    static const int64_t BUCKET_US = 3600LL * 1000000;
+
+    struct Entry {
+        int32_t user_id;
+        uint32_t segment;
+        int64_t timestamp_us;
+        uint64_t offset;
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    AuditIndex(const std::string& log_path, bool binary_records);
+    ~AuditIndex();
+
+    // Suitable for LogWriter::Options::on_written
+    void add(const std::vector<LogWriter::RecordLocation>& batch);
+
+    // Records of user_id with from_us <= timestamp <= to_us, oldest first, as text lines
+    std::vector<std::string> query(int32_t user_id, int64_t from_us, int64_t to_us, size_t limit);
+
+    size_t size() const;
+
+private:
+    std::string log_path;
+    bool binary_records;
+    int fd;
+    size_t num_entries;
+    std::unordered_map<int32_t, std::map<int64_t, std::vector<Entry>>> by_user;
+    mutable std::mutex indexMutex;
+
+    void insert(const Entry& entry);
+    // Fills in the raw bytes of entries that all live in the same segment, in offset order
+    void read_segment(uint32_t segment, const std::vector<std::pair<const Entry*, std::string*>>& wanted) const;
+    std::string to_text(const Entry& entry, const std::string& raw) const;
+};
+
+#endif
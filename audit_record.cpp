@@ -0,0 +1,107 @@
+#include "audit_record.h"
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+using namespace std;
+
+const char AUDIT_LOG_MAGIC[8] = {'A', 'U', 'D', 'I', 'T', 'L', 'G', '1'};
+
+int64_t audit_now_us() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+}
+
+AuditRecord::AuditRecord(const Request& r, int64_t _timestamp_us) :
+    timestamp_us(_timestamp_us), user_id(r.user_id), type(r.type), amount(r.amount),
+    filename(r.filename.substr(0, UINT16_MAX)) {}
+
+void AuditRecord::encode(string& out) const {
+    char header[HEADER_SIZE];
+    uint8_t type_byte = static_cast<uint8_t>(type);
+    uint16_t filename_len = static_cast<uint16_t>(filename.size());
+
+    header[0] = type_byte;
+    header[1] = 0;
+    memcpy(header + 2, &filename_len, 2);
+    memcpy(header + 4, &user_id, 4);
+    memcpy(header + 8, &timestamp_us, 8);
+    memcpy(header + 16, &amount, 8);
+
+    out.append(header, HEADER_SIZE);
+    out.append(filename);
+}
+
+size_t AuditRecord::decode(const char* data, size_t len, AuditRecord& rec) {
+    if (len < HEADER_SIZE) {
+        return 0;
+    }
+    uint16_t filename_len;
+    memcpy(&filename_len, data + 2, 2);
+    if (len < HEADER_SIZE + filename_len) {
+        return 0;
+    }
+
+    rec.type = static_cast<RequestType>(static_cast<uint8_t>(data[0]));
+    memcpy(&rec.user_id, data + 4, 4);
+    memcpy(&rec.timestamp_us, data + 8, 8);
+    memcpy(&rec.amount, data + 16, 8);
+    rec.filename.assign(data + HEADER_SIZE, filename_len);
+    return HEADER_SIZE + filename_len;
+}
+
+string AuditRecord::describe() const {
+    stringstream logfile;
+    logfile << "[" << user_id << "]: ";
+
+    switch(type) {
+        case LOGIN:
+            logfile << "logged in";
+            break;
+        case LOGOUT:
+            logfile << "logged out";
+            break;
+        case DEPOSIT:
+            logfile << "deposited " << amount;
+            break;
+        case WITHDRAW:
+            logfile << "withdrew " << amount;
+            break;
+        case BALANCE:
+            logfile << "viewed balance: " << amount;
+            break;
+        case EARN_INTEREST: // new option
+            logfile << "accrued interest in all accounts";
+            break;
+        case AGGREGATE:
+            logfile << "viewed bank statistics";
+            break;
+        case AUDIT_QUERY:
+            logfile << "viewed audit history";
+            break;
+        case UPLOAD_FILE:
+            logfile << "uploaded file: " << filename;
+            break;
+        case DOWNLOAD_FILE:
+            logfile << "downloaded file: " << filename;
+            break;
+        default:
+            logfile << "unknown action (type=" << type << ")";
+    }
+    return logfile.str();
+}
+
+string AuditRecord::to_text() const {
+    return format_timestamp(timestamp_us) + " " + describe();
+}
+
+string AuditRecord::format_timestamp(int64_t timestamp_us) {
+    time_t seconds = timestamp_us / 1000000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char timestamp[64];
+    size_t n = strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(timestamp + n, sizeof(timestamp) - n, ".%06ld", (long)(timestamp_us % 1000000));
+    return timestamp;
+}
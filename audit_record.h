@@ -0,0 +1,44 @@
+#ifndef _AUDIT_RECORD_H_
+#define _AUDIT_RECORD_H_
+
+#include "common.h"
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+*  One audit log entry. In the binary log format each record is a fixed 24-byte header
+*  (type, filename length, user id, timestamp, amount) followed by the filename bytes,
+*  all in host byte order. A binary log starts with the 8-byte AUDIT_LOG_MAGIC.
+*/
+struct AuditRecord {
+    static const size_t HEADER_SIZE = 24;
+
+    int64_t timestamp_us; // microseconds since the epoch
+    int32_t user_id;
+    RequestType type;
+    double amount;
+    std::string filename;
+
+    AuditRecord() : timestamp_us(0), user_id(0), type(QUIT), amount(0.0) {}
+    AuditRecord(const Request& r, int64_t timestamp_us);
+
+    // Appends the binary encoding of the record to out
+    void encode(std::string& out) const;
+    // Decodes one record from data; returns the bytes consumed, or 0 if data is truncated
+    static size_t decode(const char* data, size_t len, AuditRecord& rec);
+
+    // "[user_id]: action", the line the text log format has always used
+    std::string describe() const;
+    // describe() prefixed with the local time of the record
+    std::string to_text() const;
+
+    // Local time with microseconds, e.g. "2024-05-01 13:45:10.000123"
+    static std::string format_timestamp(int64_t timestamp_us);
+};
+
+extern const char AUDIT_LOG_MAGIC[8];
+
+int64_t audit_now_us();
+
+#endif
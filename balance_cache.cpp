@@ -0,0 +1,48 @@
+#include "balance_cache.h"
+
+using namespace std;
+
+BalanceCache::BalanceCache() : invalidated_at(0), hit_count(0), miss_count(0) {}
+
+bool BalanceCache::get(int user_id, double& balance) {
+    lock_guard<mutex> lock(cacheMutex);
+    auto it = balances.find(user_id);
+    if (it == balances.end()) {
+        miss_count++;
+        return false;
+    }
+    hit_count++;
+    balance = it->second.balance;
+    return true;
+}
+
+void BalanceCache::put(int user_id, double balance, uint64_t version) {
+    lock_guard<mutex> lock(cacheMutex);
+    if (version < invalidated_at) {
+        return;
+    }
+    auto it = balances.find(user_id);
+    if (it == balances.end()) {
+        balances[user_id] = Entry{balance, version};
+    } else if (it->second.version <= version) {
+        it->second = Entry{balance, version};
+    }
+}
+
+void BalanceCache::invalidate_all(uint64_t version) {
+    lock_guard<mutex> lock(cacheMutex);
+    if (version > invalidated_at) {
+        invalidated_at = version;
+        balances.clear();
+    }
+}
+
+uint64_t BalanceCache::hits() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return hit_count;
+}
+
+uint64_t BalanceCache::misses() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return miss_count;
+}
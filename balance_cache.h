@@ -0,0 +1,41 @@
+#ifndef _BALANCE_CACHE_H_
+#define _BALANCE_CACHE_H_
+
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+/*
+*  Client-side copy of the balances of one finance server. Each balance is tagged with
+*  the server's change number it reflects, taken from the response that carried it or
+*  from the change the server pushed. A balance only replaces one with an older number,
+*  and an interest sweep drops every balance numbered before it, so responses and pushed
+*  changes may arrive in any order without leaving a stale balance behind.
+*/
+class BalanceCache {
+public:
+    BalanceCache();
+
+    // Counts a hit or a miss
+    bool get(int user_id, double& balance);
+    void put(int user_id, double balance, uint64_t version);
+    // Every balance changed with change number version
+    void invalidate_all(uint64_t version);
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Entry {
+        double balance;
+        uint64_t version;
+    };
+
+    std::unordered_map<int, Entry> balances;
+    uint64_t invalidated_at; // balances numbered before this are stale
+    uint64_t hit_count;
+    uint64_t miss_count;
+    mutable std::mutex cacheMutex;
+};
+
+#endif
@@ -0,0 +1,680 @@
+#include "log_writer.h"
+#include "audit_record.h"
+#include "audit_index.h"
+#include "signals.h"
+#include "channel.h"
+#include "file_cache.h"
+#include "blob_store.h"
+#include "block_codec.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <vector>
+
+using namespace std;
+
+// Microbenchmarks for the servers' storage paths: ./bench <name> [count]
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const string& name, long count, double seconds) {
+    cout << "  " << name << ": " << count << " records in " << seconds << " s, "
+         << (long)(count / seconds) << " records/sec" << endl;
+}
+
+// Sustained audit-record throughput: the old ofstream + endl path against LogWriter
+static void bench_logwriter(long count) {
+    const string path = "bench_logwriter.log";
+    cout << "logwriter (" << count << " records)" << endl;
+
+    remove(path.c_str());
+    auto start = chrono::steady_clock::now();
+    {
+        ofstream logfile(path, ios::app);
+        for (long i = 0; i < count; i++) {
+            logfile << "[" << i % 1000 << "]: deposited " << 100 << endl;
+        }
+    }
+    report("ofstream+endl", count, seconds_since(start));
+
+    const LogWriter::Durability modes[] = {LogWriter::BUFFERED, LogWriter::FSYNC};
+    for (LogWriter::Durability mode : modes) {
+        remove(path.c_str());
+        start = chrono::steady_clock::now();
+        uint64_t batches;
+        {
+            LogWriter::Options options;
+            options.durability = mode;
+            LogWriter writer(path, options);
+            for (long i = 0; i < count; i++) {
+                writer.append("[" + to_string(i % 1000) + "]: deposited 100\n");
+            }
+            writer.flush();
+            batches = writer.batches_written();
+        }
+        report(mode == LogWriter::FSYNC ? "LogWriter fsync" : "LogWriter buffered", count, seconds_since(start));
+        cout << "    (" << batches << " batches)" << endl;
+    }
+    remove(path.c_str());
+}
+
+// Bytes and CPU per audit record in the text and binary log formats
+static void bench_auditformat(long count) {
+    cout << "auditformat (" << count << " records)" << endl;
+    Request deposit(DEPOSIT, 1234, 250.75);
+    Request upload(UPLOAD_FILE, 1234, 0, "quarterly_report.txt");
+
+    size_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        AuditRecord rec(i % 2 ? upload : deposit, audit_now_us());
+        bytes += (rec.describe() + "\n").size();
+    }
+    double seconds = seconds_since(start);
+    cout << "  text:   " << (double)bytes / count << " bytes/record, "
+         << seconds * 1e9 / count << " ns/record (no timestamp)" << endl;
+
+    bytes = 0;
+    string out;
+    start = chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        AuditRecord rec(i % 2 ? upload : deposit, audit_now_us());
+        out.clear();
+        rec.encode(out);
+        bytes += out.size();
+    }
+    seconds = seconds_since(start);
+    cout << "  binary: " << (double)bytes / count << " bytes/record, "
+         << seconds * 1e9 / count << " ns/record (with timestamp)" << endl;
+}
+
+// One user's day of history out of a month-long binary log: index lookup against a full decode scan
+static void bench_auditindex(long count) {
+    const string path = "bench_auditindex.log";
+    const int users = 1000, target = 42;
+    const int64_t span_us = 30LL * 86400 * 1000000;
+    const int64_t base_us = audit_now_us() - span_us;
+    cout << "auditindex (" << count << " records, " << users << " users, 30 days)" << endl;
+
+    remove(path.c_str());
+    remove((path + ".idx").c_str());
+    {
+        AuditIndex index(path, true);
+        LogWriter::Options options;
+        options.file_header.assign(AUDIT_LOG_MAGIC, sizeof(AUDIT_LOG_MAGIC));
+        options.on_written = [&index](const vector<LogWriter::RecordLocation>& batch) { index.add(batch); };
+        LogWriter writer(path, options);
+        Request deposit(DEPOSIT, 0, 100);
+        string encoded;
+        for (long i = 0; i < count; i++) {
+            deposit.user_id = i % users;
+            LogWriter::RecordKey key = {deposit.user_id, base_us + span_us / count * i};
+            encoded.clear();
+            AuditRecord(deposit, key.timestamp_us).encode(encoded);
+            writer.append(encoded, &key);
+        }
+        writer.close();
+    }
+
+    const int64_t from_us = base_us + span_us / 2, to_us = from_us + 86400LL * 1000000;
+    auto start = chrono::steady_clock::now();
+    AuditIndex index(path, true);
+    double load = seconds_since(start);
+    start = chrono::steady_clock::now();
+    size_t found = index.query(target, from_us, to_us, count).size();
+    double lookup = seconds_since(start);
+    cout << "  index:  " << found << " records in " << lookup * 1e3 << " ms (index load "
+         << load * 1e3 << " ms)" << endl;
+
+    start = chrono::steady_clock::now();
+    found = 0;
+    FILE* in = fopen(path.c_str(), "rb");
+    vector<char> chunk(1 << 20);
+    size_t have = 0, n;
+    fseek(in, sizeof(AUDIT_LOG_MAGIC), SEEK_SET);
+    while ((n = fread(chunk.data() + have, 1, chunk.size() - have, in)) > 0) {
+        have += n;
+        size_t pos = 0, used;
+        AuditRecord rec;
+        while ((used = AuditRecord::decode(chunk.data() + pos, have - pos, rec)) > 0) {
+            if (rec.user_id == target && rec.timestamp_us >= from_us && rec.timestamp_us <= to_us) {
+                rec.to_text();
+                found++;
+            }
+            pos += used;
+        }
+        copy(chunk.begin() + pos, chunk.begin() + have, chunk.begin());
+        have -= pos;
+    }
+    fclose(in);
+    double scan = seconds_since(start);
+    cout << "  scan:   " << found << " records in " << scan * 1e3 << " ms" << endl;
+
+    remove(path.c_str());
+    remove((path + ".idx").c_str());
+}
+
+// Per-event cost of the client's signal event log: open/write/close per event against the ring
+static void bench_signallog(long count) {
+    cout << "signallog (" << count << " events)" << endl;
+    remove("signals.log");
+
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        time_t now = time(NULL);
+        char timestamp[64];
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        string log_entry = string(timestamp) + " - " + "Signals blocked for critical section" + "\n";
+        int fd = open("signals.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0) {
+            write(fd, log_entry.c_str(), log_entry.size());
+            close(fd);
+        }
+    }
+    double seconds = seconds_since(start);
+    cout << "  open/write/close: " << seconds * 1e9 / count << " ns/event" << endl;
+
+    // Bursts smaller than the ring, drained between them outside the timed part
+    SignalHandling::start_event_log();
+    seconds = 0;
+    for (long done = 0; done < count; done += 500) {
+        start = chrono::steady_clock::now();
+        for (long i = done; i < count && i < done + 500; i++) {
+            SignalHandling::log_signal_event("Signals blocked for critical section");
+        }
+        seconds += seconds_since(start);
+        SignalHandling::flush_event_log();
+    }
+    cout << "  ring:             " << seconds * 1e9 / count << " ns/event ("
+         << SignalHandling::dropped_events() << " dropped)" << endl;
+    remove("signals.log");
+}
+
+static double thread_cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Server CPU per GB downloaded over a real channel: the old read-into-a-string path against
+// send_file_response. count is the number of megabytes served per path (at most 1024).
+static void bench_download(long count) {
+    const string path = "bench_download.dat";
+    const size_t file_mb = 32;
+    long downloads = max(1L, min(count, 1024L) / (long)file_mb);
+    cout << "download (" << downloads << " x " << file_mb << " MB)" << endl;
+    {
+        ofstream out(path, ios::binary);
+        string block(1024 * 1024, 'x');
+        for (size_t i = 0; i < file_mb; i++) {
+            out << block;
+        }
+    }
+
+    for (int zero_copy = 0; zero_copy < 2; zero_copy++) {
+        double server_cpu = 0;
+        thread server([&]() {
+            RequestChannel channel("bench_download", RequestChannel::SERVER_SIDE);
+            double start = thread_cpu_seconds();
+            for (long i = 0; i < downloads; i++) {
+                channel.receive_request(0);
+                Response resp(true, 0, "", "File downloaded successfully");
+                if (zero_copy) {
+                    int fd = open(path.c_str(), O_RDONLY);
+                    struct stat st;
+                    fstat(fd, &st);
+                    channel.send_file_response(resp, fd, 0, st.st_size);
+                    close(fd);
+                } else {
+                    ifstream infile(path);
+                    stringstream buffer;
+                    buffer << infile.rdbuf();
+                    resp.data = buffer.str();
+                    channel.send_response(resp);
+                }
+            }
+            server_cpu = thread_cpu_seconds() - start;
+        });
+
+        RequestChannel client("bench_download", RequestChannel::CLIENT_SIDE);
+        auto start = chrono::steady_clock::now();
+        size_t bytes = 0;
+        for (long i = 0; i < downloads; i++) {
+            bytes += client.send_request(Request(DOWNLOAD_FILE, 0, 0, path)).data.size();
+        }
+        double seconds = seconds_since(start);
+        server.join();
+
+        double gb = bytes / 1e9;
+        cout << "  " << (zero_copy ? "splice:     " : "read+copy:  ") << server_cpu / gb
+             << " server CPU s/GB, " << gb / seconds << " GB/s end to end" << endl;
+    }
+    remove(path.c_str());
+}
+
+// Downloads drawn from a Zipfian distribution (s = 1) over 1000 16 KB files, with a cache
+// budget of a quarter of them: reading every request from disk against FileCache
+static void bench_filecache(long count) {
+    const int files = 1000;
+    const size_t file_bytes = 16 * 1024;
+    const string dir = "bench_filecache";
+    cout << "filecache (" << count << " requests, " << files << " x " << file_bytes / 1024 << " KB files)" << endl;
+
+    if (system(("mkdir -p " + dir).c_str()) != 0) {
+        return;
+    }
+    string block(file_bytes, 'x');
+    for (int i = 0; i < files; i++) {
+        ofstream(dir + "/" + to_string(i) + ".txt") << block;
+    }
+
+    vector<double> cdf(files);
+    double total = 0;
+    for (int i = 0; i < files; i++) {
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+    mt19937 rng(42);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<string> requests(count);
+    for (long i = 0; i < count; i++) {
+        int rank = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        requests[i] = to_string(rank) + ".txt";
+    }
+
+    auto read_from_disk = [&](const string& name) {
+        shared_ptr<string> contents = make_shared<string>();
+        int fd = open((dir + "/" + name).c_str(), O_RDONLY);
+        struct stat st;
+        fstat(fd, &st);
+        contents->resize(st.st_size);
+        if (read(fd, &(*contents)[0], st.st_size) != st.st_size) {
+            contents->clear();
+        }
+        close(fd);
+        return contents;
+    };
+
+    size_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        bytes += read_from_disk(requests[i])->size();
+    }
+    double seconds = seconds_since(start);
+    cout << "  uncached: " << seconds * 1e9 / count << " ns/request" << endl;
+
+    FileCache cache(files * file_bytes / 4);
+    start = chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        FileCache::Contents contents = cache.get(requests[i]);
+        if (!contents) {
+            contents = read_from_disk(requests[i]);
+            cache.put(requests[i], contents);
+        }
+        bytes += contents->size();
+    }
+    seconds = seconds_since(start);
+    cout << "  cached:   " << seconds * 1e9 / count << " ns/request, "
+         << 100.0 * cache.hits() / count << "% hits" << endl;
+
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        cerr << "could not remove " << dir << endl;
+    }
+}
+
+// Uploads of 16 KB files where every distinct content appears under ten names: writing
+// each one out against the deduplicating BlobStore. count is capped at 20000 uploads.
+static void bench_dedup(long count) {
+    const size_t file_bytes = 16 * 1024;
+    long uploads = min(count, 20000L);
+    long distinct = max(1L, uploads / 10);
+    const string dir = "bench_dedup";
+    cout << "dedup (" << uploads << " uploads of " << distinct << " distinct 16 KB files)" << endl;
+
+    vector<string> contents(distinct);
+    for (long i = 0; i < distinct; i++) {
+        contents[i] = string(file_bytes, 'a' + i % 26);
+        memcpy(&contents[i][0], &i, sizeof(i));
+    }
+
+    if (system(("rm -rf " + dir + " && mkdir -p " + dir).c_str()) != 0) {
+        return;
+    }
+    uint64_t written = 0;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < uploads; i++) {
+        ofstream out(dir + "/" + to_string(i) + ".txt");
+        out << contents[i % distinct];
+        written += file_bytes;
+    }
+    double seconds = seconds_since(start);
+    cout << "  plain:   " << seconds * 1e6 / uploads << " us/upload, " << written / (1024 * 1024) << " MB written"
+         << endl;
+
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        return;
+    }
+    BlobStore::Stats stats;
+    {
+        BlobStore store(dir);
+        string error;
+        start = chrono::steady_clock::now();
+        for (long i = 0; i < uploads; i++) {
+            store.put(to_string(i) + ".txt", contents[i % distinct], error);
+        }
+        seconds = seconds_since(start);
+        stats = store.stats();
+    }
+    cout << "  blobs:   " << seconds * 1e6 / uploads << " us/upload, " << stats.stored_bytes / (1024 * 1024)
+         << " MB written, dedup ratio " << (double)stats.logical_bytes / stats.stored_bytes << endl;
+
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        cerr << "could not remove " << dir << endl;
+    }
+}
+
+// A store of count small distinct files (at most 200000): startup while the journal is
+// replayed and each entry checked against its blob, startup from the compacted snapshot,
+// and stat and prefix listing from the index against stat(2) on the blobs.
+static void bench_metadata(long count) {
+    long files = max(1L, min(count, 200000L));
+    const string dir = "bench_metadata";
+    cout << "metadata (" << files << " files)" << endl;
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        return;
+    }
+
+    vector<string> paths;
+    {
+        BlobStore store(dir);
+        string error;
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < files; i++) {
+            store.put("user" + to_string(i % 100) + "/file" + to_string(i) + ".txt", "contents " + to_string(i),
+                      error, false, i % 100);
+        }
+        cout << "  put:              " << seconds_since(start) * 1e6 / files << " us/file" << endl;
+        for (long i = 0; i < files; i += 97) {
+            paths.push_back(store.path_of("user" + to_string(i % 100) + "/file" + to_string(i) + ".txt"));
+        }
+    }
+
+    const char* phases[] = {"startup (journal): ", "startup (snapshot):"};
+    for (const char* phase : phases) {
+        auto start = chrono::steady_clock::now();
+        BlobStore store(dir);
+        cout << "  " << phase << " " << seconds_since(start) * 1000 << " ms for " << store.stats().files << " files"
+             << endl;
+    }
+
+    BlobStore store(dir);
+    BlobStore::FileInfo info;
+    long found = 0;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < files; i++) {
+        found += store.info("user" + to_string(i % 100) + "/file" + to_string(i) + ".txt", info);
+    }
+    cout << "  index stat:       " << seconds_since(start) * 1e6 / files << " us/file (" << found << " found)" << endl;
+
+    struct stat st;
+    found = 0;
+    start = chrono::steady_clock::now();
+    for (const string& path : paths) {
+        found += stat(path.c_str(), &st) == 0;
+    }
+    cout << "  stat(2) on blobs: " << seconds_since(start) * 1e6 / paths.size() << " us/file (" << found
+         << " found)" << endl;
+
+    start = chrono::steady_clock::now();
+    size_t listed = store.list("user42/", files).size();
+    cout << "  list prefix:      " << seconds_since(start) * 1000 << " ms for " << listed << " of " << files
+         << " files" << endl;
+
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        cerr << "could not remove " << dir << endl;
+    }
+}
+
+// Block compression of log-like text (words drawn from a small vocabulary): ratio,
+// compression speed, and reading it back whole and as random 4 KB ranges against the
+// same bytes stored plain. count is the text size in MB, at most 256.
+static void bench_compression(long count) {
+    const size_t raw_bytes = (size_t)max(1L, min(count, 256L)) * 1024 * 1024;
+    const string plain_path = "bench_plain.txt", packed_path = "bench_packed.txt";
+    cout << "compression (" << raw_bytes / (1024 * 1024) << " MB of text)" << endl;
+
+    const char* words[] = {"deposit", "withdraw", "balance", "user", "account", "login", "logout",
+                           "interest", "upload", "download", "file", "success", "failed", "amount"};
+    mt19937 rng(42);
+    string raw;
+    raw.reserve(raw_bytes + 64);
+    while (raw.size() < raw_bytes) {
+        raw += to_string(1700000000 + raw.size() / 50) + " ";
+        for (int w = 0; w < 6; w++) {
+            raw += words[rng() % 14];
+            raw += w == 5 ? '\n' : ' ';
+        }
+    }
+    raw.resize(raw_bytes);
+
+    string packed;
+    auto start = chrono::steady_clock::now();
+    if (!compress_blocks(raw, packed)) {
+        cout << "  did not compress" << endl;
+        return;
+    }
+    double seconds = seconds_since(start);
+    cout << "  compress:   " << raw_bytes / seconds / (1024 * 1024) << " MB/s, ratio "
+         << (double)raw.size() / packed.size() << " (" << packed.size() / 1024 << " KB on disk)" << endl;
+
+    ofstream(plain_path, ios::binary) << raw;
+    ofstream(packed_path, ios::binary) << packed;
+    const long ranges = 20000;
+    vector<uint64_t> offsets(ranges);
+    for (long i = 0; i < ranges; i++) {
+        offsets[i] = rng() % (raw_bytes - 4096);
+    }
+    for (const string& path : {plain_path, packed_path}) {
+        int fd = open(path.c_str(), O_RDONLY);
+        BlockReader reader;
+        if (fd < 0 || !reader.open(fd)) {
+            cerr << "could not open " << path << endl;
+            return;
+        }
+        string out;
+        start = chrono::steady_clock::now();
+        bool ok = reader.read(0, reader.size(), out) && out == raw;
+        seconds = seconds_since(start);
+        cout << "  " << (reader.is_compressed() ? "packed" : "plain ") << " whole: " << raw_bytes / seconds / (1024 * 1024)
+             << " MB/s" << (ok ? "" : " (MISMATCH)") << endl;
+
+        start = chrono::steady_clock::now();
+        for (long i = 0; i < ranges; i++) {
+            out.clear();
+            ok = reader.read(offsets[i], 4096, out) && ok;
+        }
+        seconds = seconds_since(start);
+        cout << "  " << (reader.is_compressed() ? "packed" : "plain ") << " 4 KB ranges: " << seconds * 1e6 / ranges
+             << " us/read" << (ok ? "" : " (FAILED)") << endl;
+        close(fd);
+    }
+    unlink(plain_path.c_str());
+    unlink(packed_path.c_str());
+}
+
+// Aggregate throughput of a real file server (-c 64, no cache) with 1 to 64 clients
+// transferring at once, with one I/O worker (serial, as before) and with eight. Each
+// transfer uploads a distinct 1 MB file or downloads one back. count is the number of
+// transfers per level, at most 256.
+static void run_filetransfer(long transfers, int io_workers) {
+    const size_t file_bytes = 1024 * 1024;
+    const int max_clients = 64;
+    cout << "filetransfer (" << transfers << " transfers of 1 MB per level, " << io_workers << " I/O workers)"
+         << endl;
+
+    // The server keeps its storage and FIFOs in a scratch directory
+    if (system("rm -rf bench_files && mkdir -p bench_files") != 0 || chdir("bench_files") < 0) {
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("../file", "file", "-C", "0", "-c", to_string(max_clients).c_str(), "-w",
+              to_string(io_workers).c_str(), (char*)nullptr);
+        perror("exec ../file");
+        _exit(1);
+    }
+
+    // Every channel constructor waits a little, so open them all at once
+    vector<unique_ptr<RequestChannel>> channels(max_clients);
+    vector<thread> openers;
+    for (int i = 0; i < max_clients; i++) {
+        openers.emplace_back([&channels, i] {
+            channels[i].reset(new RequestChannel(RequestChannel::channel_name("file", i), RequestChannel::CLIENT_SIDE));
+        });
+    }
+    for (thread& t : openers) {
+        t.join();
+    }
+
+    for (int clients = 1; clients <= max_clients; clients *= 2) {
+        atomic<long> next(0);
+        atomic<long> failures(0);
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (int c = 0; c < clients; c++) {
+            workers.emplace_back([&, c] {
+                string data(file_bytes, 'a' + c % 26);
+                long i;
+                while ((i = next++) < transfers / 2) {
+                    // Upload a new file, then download it back
+                    string name = to_string(clients) + "_" + to_string(i) + ".txt";
+                    memcpy(&data[0], &i, sizeof(i));
+                    if (!channels[c]->send_request(Request(UPLOAD_FILE, 0, 0, name, data)).success) {
+                        failures++;
+                    }
+                    if (channels[c]->send_request(Request(DOWNLOAD_FILE, 0, 0, name)).data.size() != file_bytes) {
+                        failures++;
+                    }
+                }
+            });
+        }
+        for (thread& t : workers) {
+            t.join();
+        }
+        double seconds = seconds_since(start);
+        cout << "  " << clients << " clients: " << transfers / 2 * 2 * (file_bytes / 1e6) / seconds << " MB/s";
+        if (failures > 0) {
+            cout << " (" << failures << " failed)";
+        }
+        cout << endl;
+    }
+
+    channels[0]->send_request(Request(QUIT));
+    channels.clear();
+    waitpid(pid, nullptr, 0);
+    if (chdir("..") < 0 || system("rm -rf bench_files") != 0) {
+        cerr << "could not remove bench_files" << endl;
+    }
+}
+
+// count small (4 KB) files uploaded and downloaded over one channel of a real file
+// server, one blocking round trip at a time and pipelined 16 deep, after an untimed round
+// that pays for creating the store's directories. count is at most 5000.
+static void bench_batch(long count) {
+    const size_t file_bytes = 4096;
+    long files = max(1L, min(count, 5000L));
+    cout << "batch (" << files << " files of 4 KB over one channel)" << endl;
+
+    if (system("rm -rf bench_files && mkdir -p bench_files") != 0 || chdir("bench_files") < 0) {
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("../file", "file", (char*)nullptr);
+        perror("exec ../file");
+        _exit(1);
+    }
+    RequestChannel channel("file", RequestChannel::CLIENT_SIDE);
+
+    auto upload = [&](const string& round, long i) {
+        string data(file_bytes, 'a' + i % 26);
+        memcpy(&data[0], &i, sizeof(i));
+        return Request(UPLOAD_FILE, 0, 0, round + to_string(i) + ".txt", data);
+    };
+    auto download = [&](const string& round, long i) {
+        return Request(DOWNLOAD_FILE, 0, 0, round + to_string(i) + ".txt");
+    };
+    const string rounds[] = {"warmup", "serial", "pipelined"};
+    for (const string& round : rounds) {
+        for (int phase = 0; phase < 2; phase++) {
+            long failures = 0;
+            auto make = [&](size_t i) { return phase == 0 ? upload(round, i) : download(round, i); };
+            auto check = [&](size_t, const Response& resp) {
+                failures += !resp.success || (phase == 1 && resp.data.size() != file_bytes);
+            };
+            auto start = chrono::steady_clock::now();
+            if (round != "pipelined") {
+                for (long i = 0; i < files; i++) {
+                    check(i, channel.send_request(make(i)));
+                }
+            } else {
+                channel.send_pipelined(files, 16, make, check);
+            }
+            double seconds = seconds_since(start);
+            if (round == "warmup") {
+                continue;
+            }
+            cout << "  " << round << " " << (phase == 0 ? "upload:  " : "download:") << " " << seconds * 1e6 / files
+                 << " us/file, " << (long)(files / seconds) << " files/sec";
+            if (failures > 0) {
+                cout << " (" << failures << " failed)";
+            }
+            cout << endl;
+        }
+    }
+
+    channel.send_request(Request(QUIT));
+    waitpid(pid, nullptr, 0);
+    if (chdir("..") < 0 || system("rm -rf bench_files") != 0) {
+        cerr << "could not remove bench_files" << endl;
+    }
+}
+
+static void bench_filetransfer(long count) {
+    long transfers = max(2L, min(count, 256L));
+    run_filetransfer(transfers, 1);
+    run_filetransfer(transfers, 8);
+}
+
+int main(int argc, char* argv[]) {
+    string name = argc > 1 ? argv[1] : "all";
+    long count = argc > 2 ? atol(argv[2]) : 1000000;
+
+    if (name == "logwriter" || name == "all") bench_logwriter(count);
+    if (name == "auditformat" || name == "all") bench_auditformat(count);
+    if (name == "auditindex" || name == "all") bench_auditindex(count);
+    if (name == "signallog" || name == "all") bench_signallog(count);
+    if (name == "download" || name == "all") bench_download(count);
+    if (name == "filecache" || name == "all") bench_filecache(count);
+    if (name == "dedup" || name == "all") bench_dedup(count);
+    if (name == "filetransfer" || name == "all") bench_filetransfer(count);
+    if (name == "batch" || name == "all") bench_batch(count);
+    if (name == "compression" || name == "all") bench_compression(count);
+    if (name == "metadata" || name == "all") bench_metadata(count);
+    return 0;
+}
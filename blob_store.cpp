@@ -0,0 +1,473 @@
+#include "blob_store.h"
+#include "block_codec.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <ctime>
+
+using namespace std;
+
+static bool write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+BlobStore::BlobStore(const string& _root) :
+    root(_root), blob_dir(_root + "/blobs"), journal_fd(-1), journal_entries(0), logical_bytes(0), stored_bytes(0), disk_bytes(0),
+    dedup_hits(0) {
+    mkdir(root.c_str(), 0755);
+    mkdir(blob_dir.c_str(), 0755);
+    load_index();
+}
+
+BlobStore::~BlobStore() {
+    if (journal_fd >= 0) {
+        close(journal_fd);
+    }
+}
+
+// MurmurHash64A
+uint64_t BlobStore::hash(const char* data, size_t len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = len * m;
+
+    const char* end = data + (len & ~(size_t)7);
+    for (const char* p = data; p != end; p += 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    const unsigned char* tail = (const unsigned char*)end;
+    switch (len & 7) {
+        case 7: h ^= uint64_t(tail[6]) << 48; // fall through
+        case 6: h ^= uint64_t(tail[5]) << 40; // fall through
+        case 5: h ^= uint64_t(tail[4]) << 32; // fall through
+        case 4: h ^= uint64_t(tail[3]) << 24; // fall through
+        case 3: h ^= uint64_t(tail[2]) << 16; // fall through
+        case 2: h ^= uint64_t(tail[1]) << 8;  // fall through
+        case 1: h ^= uint64_t(tail[0]);
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+static const string INDEX_HEADER = "blobindex 2";
+
+static string format_entry(const string& filename, const string& blob, uint64_t size, uint64_t disk_size,
+                           int owner, int64_t mtime) {
+    return blob + " " + to_string(size) + " " + to_string(disk_size) + " " + to_string(owner) + " " +
+           to_string(mtime) + " " + to_string(filename.size()) + " " + filename + "\n";
+}
+
+string BlobStore::blob_path(const string& blob) const {
+    return blob_dir + "/" + blob.substr(0, 2) + "/" + blob;
+}
+
+/*
+*  Entry lines are "<blob> <size> <disk size> <owner> <mtime> <name length> <name>\n"; a
+*  later line for a name replaces an earlier one. An index from before sharding has no
+*  header line, lines of "<blob> <size> <name length> <name>\n" and its blobs directly in
+*  blobs/; it is checked entry by entry, its blobs are moved into place, and it is
+*  rewritten in the current format.
+*/
+void BlobStore::load_index() {
+    // Blobs are written in tmp/ and renamed into place; anything left there is partial
+    string tmp_dir = blob_dir + "/tmp";
+    mkdir(tmp_dir.c_str(), 0755);
+    remove_unused(tmp_dir);
+
+    string index_path = blob_dir + "/index";
+    string journal_path = blob_dir + "/journal";
+    bool legacy = false;
+    size_t snapshot_entries = 0;
+    {
+        ifstream in(index_path, ios::binary);
+        string header;
+        if (in && in.peek() != EOF) {
+            legacy = !getline(in, header) || header != INDEX_HEADER;
+            if (legacy) {
+                in.clear();
+                in.seekg(0);
+            }
+            snapshot_entries = load_entries(in, legacy, legacy);
+        }
+    }
+    {
+        ifstream in(journal_path, ios::binary);
+        journal_entries = load_entries(in, true, false);
+    }
+
+    if (legacy) {
+        // Blobs the old index did not name, left by a crash before they were indexed
+        DIR* dir = opendir(blob_dir.c_str());
+        if (dir) {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                string file = entry->d_name;
+                struct stat st;
+                if (file != "index" && file != "journal" && stat((blob_dir + "/" + file).c_str(), &st) == 0 &&
+                    S_ISREG(st.st_mode)) {
+                    unlink((blob_dir + "/" + file).c_str());
+                }
+            }
+            closedir(dir);
+        }
+    }
+
+    if (legacy || journal_entries > 256 + snapshot_entries / 4) {
+        compact();
+    } else {
+        journal_fd = open(journal_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (journal_fd < 0) {
+            perror(("Error opening blob journal " + journal_path).c_str());
+        }
+    }
+}
+
+// Links every complete entry in; checked entries only if their blob is intact
+size_t BlobStore::load_entries(istream& in, bool checked, bool legacy) {
+    size_t count = 0;
+    string blob;
+    Name name;
+    uint64_t disk_size = 0;
+    size_t name_len;
+    while (in >> blob >> name.size) {
+        name.owner = 0;
+        name.mtime = 0;
+        if (!legacy && !(in >> disk_size >> name.owner >> name.mtime)) {
+            break;
+        }
+        if (!(in >> name_len) || in.get() != ' ') {
+            break;
+        }
+        string filename(name_len, '\0');
+        if (!in.read(&filename[0], name_len) || in.get() != '\n') {
+            break; // torn last line
+        }
+        count++;
+        name.blob = blob;
+        int64_t blob_mtime;
+        if (checked && !check_blob(blob, name.size, disk_size, blob_mtime)) {
+            continue;
+        }
+        if (legacy) {
+            name.mtime = blob_mtime;
+        }
+        link(filename, name, disk_size);
+    }
+    return count;
+}
+
+// Whether blob holds size bytes once read back; moves a blob from before sharding into place
+bool BlobStore::check_blob(const string& blob, uint64_t size, uint64_t& disk_size, int64_t& mtime) {
+    string path = blob_path(blob);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        string flat_path = blob_dir + "/" + blob;
+        mkdir((blob_dir + "/" + blob.substr(0, 2)).c_str(), 0755);
+        if (rename(flat_path.c_str(), path.c_str()) == 0) {
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+    }
+    BlockReader reader;
+    struct stat st;
+    bool intact = fd >= 0 && reader.open(fd) && reader.size() == size && fstat(fd, &st) == 0;
+    if (intact) {
+        disk_size = st.st_size;
+        mtime = st.st_mtime;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return intact;
+}
+
+// Removes the files in dir that are not blobs any name points at
+void BlobStore::remove_unused(const string& dir_path) {
+    DIR* dir = opendir(dir_path.c_str());
+    if (!dir) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        string file = entry->d_name;
+        if (file != "." && file != ".." && blobs.find(file) == blobs.end()) {
+            unlink((dir_path + "/" + file).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+/*
+*  Writes the names to a new snapshot, renames it over the old one and starts an empty
+*  journal. A crash between the two only means the journal is replayed over a snapshot
+*  that already has its entries. Blobs no name points at, left by a crash between
+*  storing a blob and journaling it, are removed while the shard directories are read.
+*/
+void BlobStore::compact() {
+    for (int shard = 0; shard < 256; shard++) {
+        char sub[4];
+        snprintf(sub, sizeof(sub), "%02x", shard);
+        remove_unused(blob_dir + "/" + sub);
+    }
+
+    string index_path = blob_dir + "/index";
+    string tmp_path = index_path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(("Error opening blob index " + tmp_path).c_str());
+        return;
+    }
+    string out = INDEX_HEADER + "\n";
+    bool ok = true;
+    for (const auto& name : names) {
+        const Name& n = name.second;
+        out += format_entry(name.first, n.blob, n.size, blobs[n.blob].disk_size, n.owner, n.mtime);
+        if (out.size() >= 1 << 20) {
+            ok = ok && write_all(fd, out.data(), out.size());
+            out.clear();
+        }
+    }
+    ok = ok && write_all(fd, out.data(), out.size()) && fsync(fd) == 0;
+    close(fd);
+    ok = ok && rename(tmp_path.c_str(), index_path.c_str()) == 0;
+    if (!ok) {
+        perror("Failed to replace blob index");
+        unlink(tmp_path.c_str());
+    }
+
+    string journal_path = blob_dir + "/journal";
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (ok ? O_TRUNC : 0);
+    journal_fd = open(journal_path.c_str(), flags, 0644);
+    if (journal_fd < 0) {
+        perror(("Error opening blob journal " + journal_path).c_str());
+    }
+    if (ok) {
+        journal_entries = 0;
+    }
+}
+
+void BlobStore::append_journal(const string& filename, const Name& name, uint64_t disk_size) {
+    if (journal_fd < 0) {
+        return;
+    }
+    string line = format_entry(filename, name.blob, name.size, disk_size, name.owner, name.mtime);
+    if (!write_all(journal_fd, line.data(), line.size())) {
+        perror("Blob journal write failed");
+    }
+    journal_entries++;
+}
+
+bool BlobStore::same_contents(const string& blob, const string& data) const {
+    int fd = open(blob_path(blob).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    BlockReader reader;
+    bool same = reader.open(fd) && reader.size() == data.size();
+    // A piece (one block, if compressed) at a time, so a large blob is never held whole
+    const size_t step = reader.is_compressed() ? reader.get_block_size() : 65536;
+    string piece;
+    for (uint64_t pos = 0; same && pos < data.size(); pos += step) {
+        size_t len = min((uint64_t)step, data.size() - pos);
+        piece.clear();
+        same = reader.read(pos, len, piece) && memcmp(piece.data(), data.data() + pos, len) == 0;
+    }
+    close(fd);
+    return same;
+}
+
+void BlobStore::link(const string& filename, const Name& name, uint64_t disk_size) {
+    auto current = names.find(filename);
+    if (current != names.end() && current->second.blob == name.blob) {
+        current->second = name; // the same contents again; only owner and time change
+        return;
+    }
+    unlink_name(filename);
+    Blob& b = blobs[name.blob];
+    if (b.refs == 0) {
+        b.size = name.size;
+        b.disk_size = disk_size;
+        stored_bytes += name.size;
+        disk_bytes += disk_size;
+    }
+    b.refs++;
+    names[filename] = name;
+    logical_bytes += name.size;
+}
+
+void BlobStore::unlink_name(const string& filename) {
+    auto it = names.find(filename);
+    if (it == names.end()) {
+        return;
+    }
+    logical_bytes -= it->second.size;
+    auto b = blobs.find(it->second.blob);
+    if (b != blobs.end() && --b->second.refs == 0) {
+        stored_bytes -= b->second.size;
+        disk_bytes -= b->second.disk_size;
+        unlink(blob_path(b->first).c_str());
+        blobs.erase(b);
+    }
+    names.erase(it);
+}
+
+/*
+*  Comparing against existing blobs and writing a new one happen outside the store lock,
+*  so uploads of different files overlap. The lock is only held to look up and update
+*  the maps; blobs that appeared in the meantime are checked before a new one is named.
+*/
+bool BlobStore::put(const string& filename, const string& data, string& error, bool compress, int owner) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash(data.data(), data.size()));
+
+    vector<string> candidates;
+    {
+        lock_guard<mutex> lock(storeMutex);
+        for (int k = 0; ; k++) {
+            string blob = k == 0 ? string(hex) : string(hex) + "-" + to_string(k);
+            auto b = blobs.find(blob);
+            if (b == blobs.end()) {
+                break;
+            }
+            if (b->second.size == data.size()) {
+                candidates.push_back(blob);
+            }
+        }
+    }
+    string match;
+    for (const string& blob : candidates) {
+        if (same_contents(blob, data)) {
+            match = blob;
+            break;
+        }
+    }
+
+    string tmp_path;
+    uint64_t disk_size = 0;
+    if (match.empty()) {
+        // Small files are not worth a block table. A plain file that happens to start
+        // with the block magic is packed anyway so it cannot be mistaken for one.
+        string packed;
+        const string* contents = &data;
+        bool looks_packed = data.compare(0, sizeof(BLOCK_MAGIC), BLOCK_MAGIC, sizeof(BLOCK_MAGIC)) == 0;
+        if ((compress && data.size() >= 4096 && compress_blocks(data, packed)) ||
+            (looks_packed && compress_blocks(data, packed, true))) {
+            contents = &packed;
+        }
+        disk_size = contents->size();
+
+        static atomic<unsigned> tmp_counter(0);
+        tmp_path = blob_dir + "/tmp/" + hex + "." + to_string(tmp_counter++);
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || !write_all(fd, contents->data(), contents->size())) {
+            if (fd >= 0) {
+                close(fd);
+                unlink(tmp_path.c_str());
+            }
+            error = "Failed to create file";
+            return false;
+        }
+        close(fd);
+    }
+
+    unique_lock<mutex> lock(storeMutex);
+    if (!match.empty() && blobs.find(match) == blobs.end()) {
+        // The matching blob lost its last name meanwhile and has been deleted
+        lock.unlock();
+        return put(filename, data, error, compress, owner);
+    }
+    bool wrote = false;
+    if (match.empty()) {
+        for (int k = 0; match.empty(); k++) {
+            string blob = k == 0 ? string(hex) : string(hex) + "-" + to_string(k);
+            auto b = blobs.find(blob);
+            if (b == blobs.end()) {
+                mkdir((blob_dir + "/" + blob.substr(0, 2)).c_str(), 0755);
+                if (rename(tmp_path.c_str(), blob_path(blob).c_str()) < 0) {
+                    unlink(tmp_path.c_str());
+                    error = "Failed to create file";
+                    return false;
+                }
+                wrote = true;
+                match = blob;
+            } else if (find(candidates.begin(), candidates.end(), blob) == candidates.end() &&
+                       b->second.size == data.size() && same_contents(blob, data)) {
+                match = blob; // stored by a concurrent upload of the same contents
+            }
+        }
+        if (!wrote) {
+            unlink(tmp_path.c_str());
+        }
+    }
+
+    if (!wrote) {
+        dedup_hits++;
+    }
+    // Journaled before linking, which may delete the blob filename pointed at until now
+    Name name = {match, data.size(), owner, (int64_t)time(nullptr)};
+    uint64_t match_disk_size = wrote ? disk_size : blobs[match].disk_size;
+    append_journal(filename, name, match_disk_size);
+    link(filename, name, match_disk_size);
+    return true;
+}
+
+string BlobStore::path_of(const string& filename) const {
+    lock_guard<mutex> lock(storeMutex);
+    auto it = names.find(filename);
+    return it == names.end() ? string() : blob_path(it->second.blob);
+}
+
+bool BlobStore::info(const string& filename, FileInfo& info) const {
+    lock_guard<mutex> lock(storeMutex);
+    auto it = names.find(filename);
+    if (it == names.end()) {
+        return false;
+    }
+    const Name& n = it->second;
+    info = FileInfo{n.blob, n.size, blobs.at(n.blob).disk_size, n.owner, n.mtime};
+    return true;
+}
+
+vector<pair<string, BlobStore::FileInfo>> BlobStore::list(const string& prefix, size_t limit,
+                                                          const string& after) const {
+    lock_guard<mutex> lock(storeMutex);
+    vector<pair<string, FileInfo>> files;
+    auto it = after < prefix ? names.lower_bound(prefix) : names.upper_bound(after);
+    for (; it != names.end() && files.size() < limit && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+        const Name& n = it->second;
+        files.emplace_back(it->first, FileInfo{n.blob, n.size, blobs.at(n.blob).disk_size, n.owner, n.mtime});
+    }
+    return files;
+}
+
+BlobStore::Stats BlobStore::stats() const {
+    lock_guard<mutex> lock(storeMutex);
+    Stats s = {names.size(), blobs.size(), logical_bytes, stored_bytes, disk_bytes, dedup_hits};
+    return s;
+}
@@ -0,0 +1,105 @@
+#ifndef _BLOB_STORE_H_
+#define _BLOB_STORE_H_
+
+#include <string>
+#include <iosfwd>
+#include <unordered_map>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+/*
+*  Content-addressed storage for the file server. Each distinct content is written once
+*  to <root>/blobs/<first two hex digits>/<hash>, so no directory grows past 1/256th of
+*  the store. The filename -> blob map, with each file's size, owner and upload time, is
+*  held in memory and persisted as a snapshot (<root>/blobs/index) plus an append-only
+*  journal of changes since (<root>/blobs/journal). Stat and listing are answered from
+*  memory without touching the disk. Blobs are reference counted by the names pointing
+*  at them and removed when the last one is overwritten.
+*
+*  On startup only journal entries are checked against the blobs they name; the snapshot
+*  is trusted, since every change to it went through the journal first. The journal is
+*  folded into a new snapshot at startup once it has grown past a quarter of it.
+*
+*  Hashes are 64-bit, so a matching hash is confirmed by comparing the bytes; a real
+*  collision gets a suffixed blob name instead of sharing.
+*
+*  A blob may be stored block-compressed (see block_codec.h); hashes, comparisons and
+*  sizes always refer to the original contents, so blobs are read through BlockReader.
+*/
+class BlobStore {
+public:
+    explicit BlobStore(const std::string& root);
+    ~BlobStore();
+
+    // Stores data under filename, compressed if asked and worthwhile; false (with error
+    // set) if it could not be written
+    bool put(const std::string& filename, const std::string& data, std::string& error, bool compress = false,
+             int owner = 0);
+    // Path of the blob holding filename, or empty if the store does not know the name
+    std::string path_of(const std::string& filename) const;
+
+    struct FileInfo {
+        std::string blob;   // the content hash, with a suffix after a collision
+        uint64_t size;      // as uploaded
+        uint64_t disk_size; // as stored
+        int owner;          // user who uploaded it
+        int64_t mtime;      // upload time, seconds since the epoch
+    };
+    // false if the store does not know filename
+    bool info(const std::string& filename, FileInfo& info) const;
+    // Up to limit names starting with prefix, in name order, after the name given (for paging)
+    std::vector<std::pair<std::string, FileInfo>> list(const std::string& prefix, size_t limit,
+                                                       const std::string& after = "") const;
+
+    static uint64_t hash(const char* data, size_t len);
+
+    struct Stats {
+        size_t files;
+        size_t blobs;
+        uint64_t logical_bytes; // what the names add up to
+        uint64_t stored_bytes;  // what the distinct contents add up to
+        uint64_t disk_bytes;    // what they take on disk after compression
+        uint64_t dedup_hits;    // uploads that did not need a write
+    };
+    Stats stats() const;
+
+private:
+    struct Blob {
+        uint64_t size;
+        uint64_t disk_size;
+        size_t refs;
+    };
+    struct Name {
+        std::string blob;
+        uint64_t size;
+        int owner;
+        int64_t mtime;
+    };
+
+    std::string root;
+    std::string blob_dir;
+    int journal_fd;
+    size_t journal_entries;
+    std::map<std::string, Name> names; // ordered, for listing by prefix
+    std::unordered_map<std::string, Blob> blobs;
+    uint64_t logical_bytes;
+    uint64_t stored_bytes;
+    uint64_t disk_bytes;
+    uint64_t dedup_hits;
+    mutable std::mutex storeMutex;
+
+    std::string blob_path(const std::string& blob) const;
+    void load_index();
+    size_t load_entries(std::istream& in, bool checked, bool legacy);
+    bool check_blob(const std::string& blob, uint64_t size, uint64_t& disk_size, int64_t& mtime);
+    void remove_unused(const std::string& dir);
+    void compact();
+    bool same_contents(const std::string& blob, const std::string& data) const;
+    void link(const std::string& filename, const Name& name, uint64_t disk_size);
+    void unlink_name(const std::string& filename);
+    void append_journal(const std::string& filename, const Name& name, uint64_t disk_size);
+};
+
+#endif
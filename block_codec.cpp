@@ -0,0 +1,130 @@
+#include "block_codec.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+const char BLOCK_MAGIC[8] = {'F', 'B', 'L', 'O', 'C', 'K', 'Z', '1'};
+
+static const size_t HEADER_SIZE = 8 + 4 + 4 + 8;
+
+static bool pread_all(int fd, char* buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool compress_blocks(const string& raw, string& out, bool must_pack, uint32_t block_size) {
+    uint32_t count = (raw.size() + block_size - 1) / block_size;
+    vector<uint64_t> offsets(count + 1, 0);
+    size_t table_end = HEADER_SIZE + offsets.size() * 8;
+
+    out.assign(table_end, '\0');
+    out.reserve(table_end + compressBound(block_size) + raw.size() / 2);
+    string block(compressBound(block_size), '\0');
+    for (uint32_t i = 0; i < count; i++) {
+        size_t start = (size_t)i * block_size;
+        size_t len = min((size_t)block_size, raw.size() - start);
+        uLongf packed = block.size();
+        if (compress2((Bytef*)&block[0], &packed, (const Bytef*)raw.data() + start, len, 1) != Z_OK) {
+            return false;
+        }
+        out.append(block.data(), packed);
+        offsets[i + 1] = offsets[i] + packed;
+        // Give up early once it is clear the file will not shrink enough
+        if (!must_pack && out.size() > raw.size() - raw.size() / 8 + table_end) {
+            return false;
+        }
+    }
+
+    uint64_t raw_size = raw.size();
+    memcpy(&out[0], BLOCK_MAGIC, 8);
+    memcpy(&out[8], &block_size, 4);
+    memcpy(&out[12], &count, 4);
+    memcpy(&out[16], &raw_size, 8);
+    memcpy(&out[HEADER_SIZE], offsets.data(), offsets.size() * 8);
+    return true;
+}
+
+bool BlockReader::open(int _fd) {
+    fd = _fd;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return false;
+    }
+    raw_size = st.st_size;
+    compressed = false;
+
+    char header[HEADER_SIZE];
+    if (st.st_size < (off_t)HEADER_SIZE || !pread_all(fd, header, HEADER_SIZE, 0) ||
+        memcmp(header, BLOCK_MAGIC, 8) != 0) {
+        return true; // a plain file
+    }
+
+    uint32_t count;
+    memcpy(&block_size, header + 8, 4);
+    memcpy(&count, header + 12, 4);
+    memcpy(&raw_size, header + 16, 8);
+    if (block_size == 0 || (uint64_t)count != (raw_size + block_size - 1) / block_size) {
+        return false;
+    }
+    offsets.resize(count + 1);
+    data_start = HEADER_SIZE + offsets.size() * 8;
+    if (!pread_all(fd, (char*)offsets.data(), offsets.size() * 8, HEADER_SIZE) ||
+        data_start + offsets.back() != (uint64_t)st.st_size) {
+        return false;
+    }
+    compressed = true;
+    return true;
+}
+
+bool BlockReader::read_block(size_t index, string& out) {
+    uint64_t packed = offsets[index + 1] - offsets[index];
+    uLongf len = min((uint64_t)block_size, raw_size - (uint64_t)index * block_size);
+    scratch.resize(packed);
+    if (!pread_all(fd, &scratch[0], packed, data_start + offsets[index])) {
+        return false;
+    }
+    size_t old = out.size();
+    out.resize(old + len);
+    uLongf got = len;
+    if (uncompress((Bytef*)&out[old], &got, (const Bytef*)scratch.data(), packed) != Z_OK || got != len) {
+        out.resize(old);
+        return false;
+    }
+    return true;
+}
+
+bool BlockReader::read(uint64_t offset, size_t length, string& out) {
+    if (offset + length > raw_size) {
+        return false;
+    }
+    if (!compressed) {
+        size_t old = out.size();
+        out.resize(old + length);
+        return pread_all(fd, &out[old], length, offset);
+    }
+
+    // Inflate the covering blocks, then trim the partial ones at either end
+    size_t first = offset / block_size;
+    size_t skip = offset - (uint64_t)first * block_size;
+    size_t old = out.size();
+    for (size_t i = first; out.size() - old < skip + length && i < num_blocks(); i++) {
+        if (!read_block(i, out)) {
+            return false;
+        }
+    }
+    out.erase(old, skip);
+    out.resize(old + length);
+    return true;
+}
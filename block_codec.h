@@ -0,0 +1,56 @@
+#ifndef _BLOCK_CODEC_H_
+#define _BLOCK_CODEC_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+*  Block-compressed file format used for stored files:
+*
+*    "FBLOCKZ1" | block size (u32) | block count (u32) | raw size (u64)
+*    | block offsets (u64 x count+1, relative to the first block) | blocks
+*
+*  Each block holds block_size bytes of the original (the last one may hold fewer),
+*  deflated on its own at level 1, so any range can be read by inflating only the
+*  blocks it covers.
+*/
+extern const char BLOCK_MAGIC[8];
+
+// Compresses raw into out; false if compression would not save at least an eighth,
+// unless must_pack is set
+bool compress_blocks(const std::string& raw, std::string& out, bool must_pack = false,
+                     uint32_t block_size = 64 * 1024);
+
+/*
+*  Reads a stored file whether it is block-compressed or plain. Plain files are read
+*  with pread; callers that can send them zero-copy check is_compressed() first.
+*/
+class BlockReader {
+public:
+    BlockReader() : fd(-1), compressed(false), raw_size(0), block_size(0), data_start(0) {}
+
+    // Takes over nothing: fd stays owned by the caller. False if the header is damaged.
+    bool open(int fd);
+
+    bool is_compressed() const { return compressed; }
+    uint64_t size() const { return raw_size; }
+    size_t num_blocks() const { return compressed ? offsets.size() - 1 : 0; }
+    uint32_t get_block_size() const { return block_size; }
+
+    // Appends length bytes starting at offset to out
+    bool read(uint64_t offset, size_t length, std::string& out);
+    // Appends block index, inflated, to out
+    bool read_block(size_t index, std::string& out);
+
+private:
+    int fd;
+    bool compressed;
+    uint64_t raw_size;
+    uint32_t block_size;
+    uint64_t data_start;
+    std::vector<uint64_t> offsets;
+    std::string scratch;
+};
+
+#endif
@@ -1,17 +1,56 @@
 #include "channel.h"
-#include "signals.h"
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <unistd.h>
 #include <iostream>
 #include <cstring>
 #include <sstream>
+#include <cerrno>
+#include <algorithm>
+#include <climits>
+#include <chrono>
 
 using namespace std;
 
+typedef chrono::steady_clock::time_point Deadline;
+
+// A timeout of 0 means no limit
+static Deadline deadline_after(int timeout_seconds) {
+    return timeout_seconds > 0 ? chrono::steady_clock::now() + chrono::seconds(timeout_seconds) : Deadline::max();
+}
+
+/*
+*  Waits until fd can be read without blocking or the deadline passes, in which case it
+*  fails with errno ETIMEDOUT. A hang-up counts as readable, so read() reports it.
+*/
+static bool wait_readable(int fd, Deadline deadline) {
+    if (deadline == Deadline::max()) {
+        return true;
+    }
+    while (true) {
+        long long left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, (int)max(0LL, min(left, (long long)INT_MAX)));
+        if (ready > 0) {
+            return true;
+        }
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ready == 0 && left <= 0) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+    }
+}
+
 RequestChannel::RequestChannel(const string name, const Side side) : 
-    process_name(name), my_side(side), read_fd(-1), write_fd(-1) {
+    process_name(name), my_side(side), read_fd(-1), write_fd(-1),
+    stale_responses(0), oneway_failures(0) {
     
     read_pipe = "fifo_" + name + "_" + (side == SERVER_SIDE ? "1" : "2");
     write_pipe = "fifo_" + name + "_" + (side == SERVER_SIDE ? "2" : "1");
@@ -24,10 +63,8 @@ RequestChannel::RequestChannel(const string name, const Side side) :
         perror(("Error creating write pipe " + write_pipe).c_str());
     }
 
-    // Give both sides a chance to set up
-    usleep(100000); // Wait 0.1 seconds
-
-    // Open pipes in the correct order
+    // Open pipes in the correct order. Each open waits for the other side to open the same
+    // pipe, so either side may come first and neither has to wait for the other to start.
     if (side == SERVER_SIDE) {
         read_fd = open(read_pipe.c_str(), O_RDONLY);
         write_fd = open(write_pipe.c_str(), O_WRONLY);
@@ -40,116 +77,405 @@ RequestChannel::RequestChannel(const string name, const Side side) :
 RequestChannel::~RequestChannel() {
     close(read_fd);
     close(write_fd);
+    remove_pipes();
+}
+
+void RequestChannel::remove_pipes() {
     unlink(read_pipe.c_str());
     unlink(write_pipe.c_str());
 }
 
-Response RequestChannel::send_request(const Request& req, int timeout_seconds) {
-    // Use alarm and timeout for sending request
-    Response resp;
-    SignalHandling::timeout_occurred = false;
-    
-    if (!SignalHandling::wait_with_timeout(timeout_seconds)) {
-        return Response(false, 0, "", "Request timed out");
+/*
+*  Opens the pipes again in the same order as the constructor, except that the open
+*  which waits for the other side is retried without blocking, so a peer that never
+*  comes back costs timeout_ms rather than a hung thread. dup2 then replaces the old
+*  descriptors, so no thread using the channel ever sees a closed one.
+*/
+bool RequestChannel::reconnect(int timeout_ms) {
+    if (mkfifo(read_pipe.c_str(), 0666) < 0 && errno != EEXIST) {
+        return false;
     }
-    
-    // Use a more robust format with delimiters
-    stringstream ss;
-    ss << static_cast<int>(req.type) << "|"
-       << req.user_id << "|"
-       << req.amount << "|"
-       << req.filename << "|"
-       << req.data << "\n";
-    string msg = ss.str();
-    
-    // Write the full message
-    int bytes_written = write(write_fd, msg.c_str(), msg.size());
-    if (bytes_written < 0) {
+    if (mkfifo(write_pipe.c_str(), 0666) < 0 && errno != EEXIST) {
+        return false;
+    }
+
+    // Opening a write end without blocking fails with ENXIO until a reader is there
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    auto open_writer = [&]() {
+        int fd;
+        while ((fd = open(write_pipe.c_str(), O_WRONLY | O_NONBLOCK)) < 0 && errno == ENXIO &&
+               chrono::steady_clock::now() < deadline) {
+            usleep(1000);
+        }
+        return fd;
+    };
+
+    int new_read = -1, new_write = -1;
+    if (my_side == SERVER_SIDE) {
+        new_read = open(read_pipe.c_str(), O_RDONLY | O_NONBLOCK);
+        if (new_read >= 0) {
+            new_write = open_writer();
+        }
+    } else {
+        // The server opens its write end right after its read end, so this open is brief
+        new_write = open_writer();
+        if (new_write >= 0) {
+            new_read = open(read_pipe.c_str(), O_RDONLY);
+        }
+    }
+    if (new_read < 0 || new_write < 0) {
+        if (new_read >= 0) {
+            close(new_read);
+        }
+        if (new_write >= 0) {
+            close(new_write);
+        }
+        return false;
+    }
+
+    // Nothing the old peer left half-sent or still owed is coming now
+    read_buffer.clear();
+    stale_responses = 0;
+    fcntl(new_read, F_SETFL, fcntl(new_read, F_GETFL) & ~O_NONBLOCK);
+    fcntl(new_write, F_SETFL, fcntl(new_write, F_GETFL) & ~O_NONBLOCK);
+    dup2(new_read, read_fd);
+    dup2(new_write, write_fd);
+    close(new_read);
+    close(new_write);
+    return true;
+}
+
+/*
+*  Messages are framed as <payload length><kind><payload>, where kind is ':' for a
+*  request or response and '!' for a one-way request. Framing lets several messages
+*  sit in the pipe at once and lets payloads carry newlines and '|'.
+*/
+bool RequestChannel::write_frame(char kind, const string& payload) {
+    string frame = to_string(payload.size()) + kind + payload;
+    size_t written = 0;
+    while (written < frame.size()) {
+        ssize_t n = write(write_fd, frame.data() + written, frame.size() - written);
+        if (n < 0) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+bool RequestChannel::read_frame(char& kind, string& payload, Deadline deadline) {
+    char buf[65536];
+    size_t header_end;
+
+    // Buffer until a complete header is in; later frames stay buffered for the next call
+    while ((header_end = read_buffer.find_first_not_of("0123456789")) == string::npos) {
+        if (!wait_readable(read_fd, deadline)) {
+            return false;
+        }
+        ssize_t n = read(read_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n == 0) {
+                read_buffer.clear(); // the writer is gone, and so is the rest of its frame
+                errno = 0;
+            }
+            return false;
+        }
+        read_buffer.append(buf, n);
+    }
+    kind = read_buffer[header_end];
+    if (header_end == 0 || header_end > 19 || (kind != ':' && kind != '!')) {
+        read_buffer.clear(); // lost framing; nothing after this point can be trusted
+        return false;
+    }
+    size_t length = stoul(read_buffer.substr(0, header_end));
+
+    // Read the rest of the frame straight into the buffer. The header stays until all of
+    // it is in, so a read cut short by a signal or the deadline can be picked up again.
+    size_t frame_end = header_end + 1 + length;
+    size_t have = read_buffer.size();
+    if (have < frame_end) {
+        read_buffer.resize(frame_end);
+        while (have < frame_end) {
+            ssize_t n = -1;
+            if (wait_readable(read_fd, deadline)) {
+                n = read(read_fd, &read_buffer[have], frame_end - have);
+            }
+            if (n <= 0) {
+                if (n == 0) {
+                    read_buffer.clear();
+                    errno = 0;
+                } else {
+                    read_buffer.resize(have);
+                }
+                return false;
+            }
+            have += n;
+        }
+    }
+    if (read_buffer.size() == frame_end) {
+        read_buffer.erase(0, header_end + 1);
+        payload.swap(read_buffer);
+        read_buffer.clear();
+    } else {
+        payload = read_buffer.substr(header_end + 1, length);
+        read_buffer.erase(0, frame_end);
+    }
+    return true;
+}
+
+Response RequestChannel::send_request(const Request& req, int timeout_seconds) {
+    if (!write_frame(':', req.serialize())) {
         perror("Write failed");
-        SignalHandling::cancel_timeout();
         return Response(false, 0, "", "Write failed");
     }
+    return read_response(timeout_seconds);
+}
+
+bool RequestChannel::post_request(const Request& req) {
+    if (!write_frame(':', req.serialize())) {
+        perror("Write failed");
+        return false;
+    }
+    return true;
+}
+
+Response RequestChannel::receive_response(int timeout_seconds) {
+    return read_response(timeout_seconds);
+}
+
+/*
+*  The writes stay depth requests ahead of the reads. depth times a request's size has to
+*  fit in the pipe when the responses are large, since the server blocks writing one
+*  until it is read; likewise for depth times a response's size when the requests are.
+*/
+void RequestChannel::send_pipelined(size_t count, size_t depth, const function<Request(size_t)>& make,
+                                    const function<void(size_t, const Response&)>& done, int timeout_seconds) {
+    size_t sent = 0;
+    bool writable = true;
+    for (size_t i = 0; i < count; i++) {
+        while (writable && sent < count && sent < i + max(depth, (size_t)1)) {
+            writable = post_request(make(sent));
+            sent += writable;
+        }
+        done(i, i < sent ? receive_response(timeout_seconds) : Response(false, 0, "", "Write failed"));
+    }
+}
 
-    // Read response
-    char buf[1024];
-    int bytes_read = read(read_fd, buf, sizeof(buf)-1);
-    if (bytes_read < 0) {
+// Reads the response to the oldest outstanding request
+Response RequestChannel::read_response(int timeout_seconds) {
+    Deadline deadline = deadline_after(timeout_seconds);
+    char kind;
+    string payload;
+    errno = 0;
+    bool ok = true;
+    while (ok && stale_responses > 0) {
+        ok = read_frame(kind, payload, deadline);
+        stale_responses -= ok;
+    }
+    if (!ok || !read_frame(kind, payload, deadline)) {
+        // End of file means the server went away; report it without a message
+        if (errno == 0) {
+            stale_responses = 0;
+            return Response();
+        }
+        // This response is still on its way, so it has to be skipped when it comes
+        stale_responses++;
+        if (errno == ETIMEDOUT) {
+            Response timeout(false, 0, "", "Operation timed out");
+            timeout.timed_out = true;
+            return timeout;
+        }
         perror("Read failed");
-        SignalHandling::cancel_timeout();
         return Response(false, 0, "", "Read failed");
     }
-    buf[bytes_read] = '\0';
+    return Response::parseResponse(payload);
+}
 
-    SignalHandling::cancel_timeout();
-    
-    if (SignalHandling::timeout_occurred) {
-        return Response(false, 0, "", "Operation timed out");
+bool RequestChannel::send_oneway(const Request& req) {
+    if (!write_frame('!', req.serialize())) {
+        oneway_failures++;
+        return false;
     }
+    return true;
+}
 
-    string response_str(buf);
-    size_t pos = 0;
-    string token;
-    string delimiter = "|";
+void RequestChannel::set_nonblocking_writes() {
+    fcntl(write_fd, F_SETFL, fcntl(write_fd, F_GETFL) | O_NONBLOCK);
+}
 
-    // Parse response using same delimiter format
-    if ((pos = response_str.find(delimiter)) != string::npos) {
-        resp.success = (response_str.substr(0, pos) == "1");
-        response_str.erase(0, pos + delimiter.length());
-    }
-    if ((pos = response_str.find(delimiter)) != string::npos) {
-        resp.balance = stod(response_str.substr(0, pos));
-        response_str.erase(0, pos + delimiter.length());
+bool RequestChannel::receive_oneway(Request& req) {
+    char kind;
+    string payload;
+    if (!read_frame(kind, payload)) {
+        return false;
     }
-    if ((pos = response_str.find(delimiter)) != string::npos) {
-        resp.data = response_str.substr(0, pos);
-        resp.message = response_str.substr(pos + delimiter.length());
-    }
-    
-    return resp;
+    req = Request::parseRequest(payload);
+    req.oneway = true;
+    return true;
 }
 
 Request RequestChannel::receive_request(int timeout_seconds) {
-    char buf[1024];
-    
     // For servers, don't terminate on timeout
     bool is_server = (my_side == SERVER_SIDE);
     
-    SignalHandling::timeout_occurred = false;
-    if (!SignalHandling::wait_with_timeout(timeout_seconds)) {
-        if (is_server) {
-            // For servers, just try again instead of returning QUIT
-            return receive_request(timeout_seconds);
+    char kind;
+    string payload;
+    while (!read_frame(kind, payload, deadline_after(timeout_seconds))) {
+        if (!is_server || errno != ETIMEDOUT) {
+            // Timeout or error occurred - return QUIT to trigger cleanup
+            return Request(QUIT);
         }
-        return Request(QUIT); // Return QUIT on timeout for clients
+        // For servers, just try again instead of returning QUIT
     }
     
-    int bytes_read = read(read_fd, buf, sizeof(buf)-1);
-    
-    SignalHandling::cancel_timeout();
-    
-    if (bytes_read <= 0 || SignalHandling::timeout_occurred) {
-        // Timeout or error occurred - return QUIT to trigger cleanup
-        return Request(QUIT);
+    Request r = Request::parseRequest(payload);
+    r.oneway = (kind == '!');
+    // One-way senders never read a response, so the reply to this one must be dropped
+    lock_guard<mutex> lock(replyMutex);
+    pending_replies.push_back(r.oneway);
+    return r;
+}
+
+// Takes the oldest unanswered request; false if its reply is to be dropped
+bool RequestChannel::reply_expected() {
+    lock_guard<mutex> lock(replyMutex);
+    if (pending_replies.empty()) {
+        return true;
     }
-    
-    buf[bytes_read] = '\0';
-    return Request::parseRequest(buf);
+    bool oneway = pending_replies.front();
+    pending_replies.pop_front();
+    return !oneway;
 }
 
 void RequestChannel::send_response(const Response& resp) {
-    stringstream ss;
-    ss << (resp.success ? "1" : "0") << "|"
-       << resp.balance << "|"
-       << resp.data << "|"
-       << resp.message << "\n";
-    string msg = ss.str();
-    
-    int bytes_written = write(write_fd, msg.c_str(), msg.size());
-    if (bytes_written < 0) {
+    if (!reply_expected()) {
+        return;
+    }
+    if (!write_frame(':', resp.serialize())) {
         perror("Write failed in send_response");
     }
 }
 
+// Data is the last response field, so the frame header and the other fields can go out first
+bool RequestChannel::write_response_head(const Response& resp, size_t data_length) {
+    string head = resp.serialize();
+    string frame_head = to_string(head.size() + data_length) + ':' + head;
+    size_t written = 0;
+    while (written < frame_head.size()) {
+        ssize_t n = write(write_fd, frame_head.data() + written, frame_head.size() - written);
+        if (n < 0) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+bool RequestChannel::send_data_response(const Response& resp, const string& data) {
+    if (!reply_expected()) {
+        return true;
+    }
+    string head = resp.serialize();
+    string frame_head = to_string(head.size() + data.size()) + ':' + head;
+    struct iovec iov[2] = {{(void*)frame_head.data(), frame_head.size()}, {(void*)data.data(), data.size()}};
+    int first = 0;
+    while (first < 2) {
+        ssize_t n = writev(write_fd, iov + first, 2 - first);
+        if (n < 0) {
+            perror("Write failed in send_data_response");
+            return false;
+        }
+        // Advance past whatever the pipe took
+        while (first < 2 && (size_t)n >= iov[first].iov_len) {
+            n -= iov[first].iov_len;
+            first++;
+        }
+        if (first < 2) {
+            iov[first].iov_base = (char*)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+bool RequestChannel::send_file_response(const Response& resp, int file_fd, off_t offset, size_t length) {
+    if (!reply_expected()) {
+        return true;
+    }
+    if (!write_response_head(resp, length)) {
+        perror("Write failed in send_file_response");
+        return false;
+    }
+
+    // splice needs a pipe on one side, which a FIFO is; sendfile covers kernels without it
+    size_t sent = 0;
+    bool use_splice = true;
+    while (sent < length) {
+        ssize_t n;
+        if (use_splice) {
+            n = splice(file_fd, &offset, write_fd, NULL, length - sent, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINVAL) {
+                use_splice = false;
+                continue;
+            }
+        } else {
+            n = sendfile(write_fd, file_fd, &offset, length - sent);
+        }
+        if (n < 0) {
+            perror("Write failed in send_file_response");
+            return false;
+        }
+        if (n == 0) {
+            // The file shrank after its size was sent; pad so the framing stays intact
+            string padding(min((size_t)65536, length - sent), '\0');
+            n = write(write_fd, padding.data(), padding.size());
+            if (n < 0) {
+                perror("Write failed in send_file_response");
+                return false;
+            }
+        }
+        sent += n;
+    }
+    return true;
+}
+
+bool RequestChannel::send_stream_response(const Response& resp, size_t length,
+                                          const function<bool(string&)>& next) {
+    if (!reply_expected()) {
+        return true;
+    }
+    if (!write_response_head(resp, length)) {
+        perror("Write failed in send_stream_response");
+        return false;
+    }
+
+    string chunk;
+    bool producing = true;
+    size_t sent = 0;
+    while (sent < length) {
+        chunk.clear();
+        producing = producing && next(chunk) && !chunk.empty();
+        if (!producing) {
+            chunk.assign(min((size_t)65536, length - sent), '\0');
+        }
+        size_t len = min(chunk.size(), length - sent);
+        for (size_t written = 0; written < len; ) {
+            ssize_t n = write(write_fd, chunk.data() + written, len - written);
+            if (n < 0) {
+                perror("Write failed in send_stream_response");
+                return false;
+            }
+            written += n;
+        }
+        sent += len;
+    }
+    return true;
+}
+
 string RequestChannel::get_process_name() const {
     return process_name;
-}
\ No newline at end of file
+}
+
+string RequestChannel::channel_name(const string& base, int index) {
+    return index == 0 ? base : base + "." + to_string(index);
+}
@@ -3,6 +3,12 @@
 
 #include "common.h"
 #include <string>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <sys/types.h>
 
 class RequestChannel {
 public:
@@ -11,19 +17,79 @@ public:
     RequestChannel(const std::string process_name, const Side side);
     ~RequestChannel();
     
-    // Modified to support timeout
+    // Waits up to timeout_seconds for the response (0 = no limit). The deadline is the
+    // channel's own, kept with poll(), so any thread may send; a response that does not
+    // arrive in time comes back with timed_out set.
     Response send_request(const Request& req, int timeout_seconds = 30);
+    // The two halves of send_request, for callers that keep several requests outstanding.
+    // Servers answer a channel's requests in the order they arrive.
+    bool post_request(const Request& req);
+    Response receive_response(int timeout_seconds = 30);
+    // Sends count requests, each made by make(i) when its turn comes, with up to depth of
+    // them awaiting a response; done(i, response) is called for each in order
+    void send_pipelined(size_t count, size_t depth, const std::function<Request(size_t)>& make,
+                        const std::function<void(size_t, const Response&)>& done, int timeout_seconds = 30);
     Request receive_request(int timeout_seconds = 30);
     void send_response(const Response& resp);
+    // Sends resp with length bytes of file_fd, starting at offset, as its data. The bytes
+    // are moved from the file to the pipe in the kernel and never copied through user space.
+    bool send_file_response(const Response& resp, int file_fd, off_t offset, size_t length);
+    // Sends resp with data as its data field, without copying data into the frame
+    bool send_data_response(const Response& resp, const std::string& data);
+    // Sends resp with length bytes of data produced piecewise: next is called with an
+    // emptied buffer until length bytes have been written, so the data never has to be
+    // held whole. If next fails, the rest is padded to keep the framing intact.
+    bool send_stream_response(const Response& resp, size_t length, const std::function<bool(std::string&)>& next);
+
+    // Sends a request that the server handles without replying; returns false if it could
+    // not be written. Failures are also counted so callers can check them off the hot path.
+    bool send_oneway(const Request& req);
+    long get_oneway_failures() const { return oneway_failures.load(); }
+    // Makes writes fail with EAGAIN rather than wait while the pipe is full. Frames of up
+    // to PIPE_BUF bytes go into a pipe whole or not at all, so this is for one-way senders
+    // of small messages that would rather drop one than stall.
+    void set_nonblocking_writes();
+
+    // Removes the pipes from the filesystem, so a restarted peer creates new ones instead
+    // of opening pipes that may still hold the old peer's unread messages
+    void remove_pipes();
+    // Reopens both pipes once the other side has been restarted and swaps them in place,
+    // so threads holding the channel carry on with the new peer. False if the other side
+    // has not opened its end within timeout_ms.
+    bool reconnect(int timeout_ms);
+    // Reads the next request for a side that never replies, such as a listener for pushed
+    // notifications. Waits without a timeout; false once the other side has gone away.
+    bool receive_oneway(Request& req);
     std::string get_process_name() const;
 
+    // Name of the index-th channel of a server; index 0 is the server's own name
+    static std::string channel_name(const std::string& base, int index);
+
 private:
+    typedef std::chrono::steady_clock::time_point Deadline;
+
     std::string process_name;
     Side my_side;
     std::string read_pipe;
     std::string write_pipe;
     int read_fd;
     int write_fd;
+    std::string read_buffer; // bytes read past the end of the last frame
+    // Responses still due for requests that timed out; they are read and dropped before
+    // the next response, so that one goes to the request it answers
+    size_t stale_responses;
+    // Per request received and not yet answered, whether it was one-way. A server may read
+    // the next request while the previous one's response is still being sent.
+    std::deque<bool> pending_replies;
+    std::mutex replyMutex;
+    std::atomic<long> oneway_failures;
+
+    bool reply_expected();
+    Response read_response(int timeout_seconds);
+    bool write_frame(char kind, const std::string& payload);
+    bool write_response_head(const Response& resp, size_t data_length);
+    // Fails with errno ETIMEDOUT if the frame is not in by the deadline
+    bool read_frame(char& kind, std::string& payload, Deadline deadline = Deadline::max());
 };
 
 #endif
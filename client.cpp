@@ -1,12 +1,23 @@
 #include "common.h"
 #include "channel.h"
 #include "signals.h"
+#include "finance_router.h"
+#include "async_channel.h"
+#include "supervisor.h"
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <fstream>
 #include <vector>
 #include <limits>
+#include <sstream>
+#include <ctime>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using namespace std;
 using namespace SignalHandling;
@@ -22,6 +33,10 @@ void print_menu() {
          << "7. Logout\n"
          << "8. Server Status\n"
          << "9. Update Interest for All Accounts\n"   // New option
+         << "10. Bank Statistics\n"
+         << "11. Audit History\n"
+         << "12. List Files\n"
+         << "13. Transfer Several Files\n"
          << "0. Exit\n"
          << "Enter choice: ";
 }
@@ -68,117 +83,780 @@ void retry_operation(const string& operation_name, Func operation, int max_retri
     }
 }
 
-int main() {
+// Files larger than this are transferred in chunks, so a retry only resends what is missing
+static const size_t TRANSFER_CHUNK = 1024 * 1024;
+
+/*
+*  Uploads content in chunks starting where the server's partial copy ends, or from the
+*  beginning unless resume is set. Small files go in a single request as before.
+*/
+Response upload_file(RequestChannel& file, int user_id, const string& filename, const string& content,
+                     bool resume, int timeout_seconds = 30) {
+    if (content.size() <= TRANSFER_CHUNK) {
+        return file.send_request(Request(UPLOAD_FILE, user_id, 0, filename, content), timeout_seconds);
+    }
+
+    size_t offset = 0;
+    if (resume) {
+        Request query(FILE_SIZE, user_id, 0, filename);
+        Response size = file.send_request(query, timeout_seconds);
+        size_t partial = size.data.find("partial=");
+        if (size.success && partial != string::npos) {
+            offset = min((size_t)stoull(size.data.substr(partial + 8)), content.size());
+            if (offset > 0) {
+                cout << "Resuming upload at byte " << offset << endl;
+            }
+        }
+    }
+
+    Response resp(false, 0, "", "Nothing to upload");
+    do {
+        Request chunk(UPLOAD_FILE, user_id, 0, filename, content.substr(offset, TRANSFER_CHUNK));
+        chunk.offset = offset;
+        chunk.length = content.size();
+        resp = file.send_request(chunk, timeout_seconds);
+        if (!resp.success) {
+            return resp;
+        }
+        offset += chunk.data.size();
+    } while (offset < content.size());
+    return resp;
+}
+
+/*
+*  Downloads filename in chunks, appending to received. A retry passes the same buffer
+*  back in and continues from its end; if the file has shrunk below it in the meantime,
+*  the download starts over.
+*/
+Response download_file(RequestChannel& file, int user_id, const string& filename, string& received,
+                       int timeout_seconds = 30) {
+    if (!received.empty()) {
+        cout << "Resuming download at byte " << received.size() << endl;
+    }
+    while (true) {
+        Request range(DOWNLOAD_FILE, user_id, 0, filename);
+        range.offset = received.size();
+        range.length = TRANSFER_CHUNK;
+        Response resp = file.send_request(range, timeout_seconds);
+        if (!resp.success) {
+            if (resp.balance > 0 && resp.balance < received.size()) {
+                received.clear();
+            }
+            return resp;
+        }
+        if (resp.balance < received.size()) {
+            received.clear();
+            continue;
+        }
+        received += resp.data;
+        if (received.size() >= resp.balance) {
+            resp.data.clear();
+            return resp;
+        }
+    }
+}
+
+// Requests a batch keeps outstanding. Small enough that that many upload responses, or
+// download requests, fit in a pipe while the other side is busy writing.
+static const size_t PIPELINE_DEPTH = 16;
+
+/*
+*  Uploads several files in one pipelined session, returning a response per file. Each
+*  file is read when its request is due, so reading the next one overlaps the server
+*  storing the last. Files larger than TRANSFER_CHUNK go as chunks, back to back.
+*/
+vector<Response> upload_batch(RequestChannel& file, int user_id, const vector<string>& filenames) {
+    struct Piece {
+        size_t file;
+        size_t offset;
+    };
+    vector<Piece> pieces;
+    vector<size_t> sizes(filenames.size());
+    vector<Response> results(filenames.size(), Response(false, 0, "", "Could not open file"));
+    for (size_t i = 0; i < filenames.size(); i++) {
+        struct stat st;
+        if (stat(filenames[i].c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        sizes[i] = st.st_size;
+        for (size_t offset = 0; offset == 0 || offset < sizes[i]; offset += TRANSFER_CHUNK) {
+            pieces.push_back(Piece{i, offset});
+        }
+    }
+
+    file.send_pipelined(pieces.size(), PIPELINE_DEPTH, [&](size_t p) {
+        const Piece& piece = pieces[p];
+        size_t size = sizes[piece.file];
+        string data(min(size - piece.offset, TRANSFER_CHUNK), '\0');
+        ifstream in(filenames[piece.file], ios::binary);
+        in.seekg(piece.offset);
+        in.read(&data[0], data.size());
+        data.resize(in.gcount());
+
+        Request req(UPLOAD_FILE, user_id, 0, filenames[piece.file], data);
+        if (size > TRANSFER_CHUNK) {
+            req.offset = piece.offset;
+            req.length = size;
+        }
+        return req;
+    }, [&](size_t p, const Response& resp) {
+        // A file's first failed chunk says why; the ones after it fail because of it
+        Response& result = results[pieces[p].file];
+        if (pieces[p].offset == 0 || result.success) {
+            result = resp;
+        }
+    });
+    return results;
+}
+
+// Writes a downloaded file, creating the directories in its name
+static bool save_file(const string& filename, const string& contents) {
+    for (size_t slash = filename.find('/'); slash != string::npos; slash = filename.find('/', slash + 1)) {
+        mkdir(filename.substr(0, slash).c_str(), 0755);
+    }
+    ofstream out(filename, ios::binary);
+    return out.write(contents.data(), contents.size()) && (out.close(), !out.fail());
+}
+
+/*
+*  Downloads several files in one pipelined session and saves them, returning a response
+*  per file. Each file is written out while the server is already sending the next. A
+*  file larger than TRANSFER_CHUNK gets its first chunk in the session and the rest
+*  afterwards, as download_file would.
+*/
+vector<Response> download_batch(RequestChannel& file, int user_id, const vector<string>& filenames) {
+    vector<Response> results(filenames.size());
+    vector<pair<size_t, string>> unfinished;
+    file.send_pipelined(filenames.size(), PIPELINE_DEPTH, [&](size_t i) {
+        Request range(DOWNLOAD_FILE, user_id, 0, filenames[i]);
+        range.length = TRANSFER_CHUNK;
+        return range;
+    }, [&](size_t i, const Response& resp) {
+        results[i] = resp;
+        if (resp.success && resp.balance > resp.data.size()) {
+            unfinished.emplace_back(i, resp.data);
+        } else if (resp.success && !save_file(filenames[i], resp.data)) {
+            results[i] = Response(false, 0, "", "Could not create output file");
+        }
+        results[i].data.clear();
+    });
+
+    for (auto& partial : unfinished) {
+        size_t i = partial.first;
+        results[i] = download_file(file, user_id, filenames[i], partial.second);
+        if (results[i].success && !save_file(filenames[i], partial.second)) {
+            results[i] = Response(false, 0, "", "Could not create output file");
+        }
+    }
+    return results;
+}
+
+// Whether a name from the server may be used as a local path: relative and without ".."
+static bool safe_local_path(const string& name) {
+    if (name.empty() || name[0] == '/') {
+        return false;
+    }
+    stringstream parts(name);
+    string part;
+    while (getline(parts, part, '/')) {
+        if (part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Names of the stored files under dir, a page at a time. Anyone may upload a name, so
+// names that would be saved outside the current directory are left out.
+static vector<string> list_stored_files(RequestChannel& file, int user_id, const string& dir) {
+    vector<string> names;
+    Request page(LIST_FILES, user_id, 1000);
+    page.data = dir;
+    while (true) {
+        Response resp = file.send_request(page);
+        stringstream lines(resp.data);
+        string line, last;
+        while (getline(lines, line)) {
+            // "<size> <owner> <mtime> <name>"
+            size_t name_start = 0;
+            for (int field = 0; field < 3 && name_start != string::npos; field++) {
+                name_start = line.find(' ', name_start);
+                name_start += name_start != string::npos;
+            }
+            if (name_start == string::npos) {
+                continue;
+            }
+            last = line.substr(name_start);
+            if (safe_local_path(last)) {
+                names.push_back(last);
+            } else {
+                cerr << "Skipping " << last << ": not a safe local path" << endl;
+            }
+        }
+        if (!resp.success || resp.balance < page.amount || last.empty()) {
+            return names;
+        }
+        page.filename = last;
+    }
+}
+
+// Local files directly inside dir, in name order
+static vector<string> list_local_files(const string& dir) {
+    vector<string> names;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return names;
+    }
+    string base = dir.back() == '/' ? dir : dir + "/";
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        struct stat st;
+        string path = base + entry->d_name;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            names.push_back(path);
+        }
+    }
+    closedir(d);
+    sort(names.begin(), names.end());
+    return names;
+}
+
+/*
+*  Everything needed to start the servers. Settings come from the command line, from a
+*  config file (-f) and from the head of a script; without a config file or a script the
+*  client prompts for the maximum account, the logging file and the extensions. A config
+*  file has one "<setting> <value>..." line per setting and "#" starts a comment:
+*
+*    accounts <max account>        (default 100)
+*    log <logging file>            (default system.log)
+*    extensions <ext>...           (default .txt; .txt:z stores them compressed)
+*    shards <count>                (default 1, like -S)
+*    standby yes|no                (default no, like -r)
+*    table <path>                  (persistent account table, like -p)
+*    sync none|async|sync          (like -s)
+*    log_format <format>           (like -F)
+*    file_cache <MB>               (like -C)
+*    supervise yes|no              (default no, like -w)
+*/
+struct Config {
+    int max_account = 100;
+    string log_file = "system.log";
+    vector<string> extensions = {".txt"};
+    int num_shards = 1;
+    bool with_standby = false;
+    string account_table, sync_policy; // optional persistent account table for the finance server
+    string log_format = "text";        // audit log format passed to the logging server
+    string file_cache_mb;              // download cache budget passed to the file server
+    bool supervise = false;            // restart servers that die
+};
+
+static bool is_setting(const string& name) {
+    static const vector<string> settings = {"accounts", "log", "extensions", "shards", "standby", "table", "sync",
+                                            "log_format", "file_cache", "supervise"};
+    return find(settings.begin(), settings.end(), name) != settings.end();
+}
+
+// words is a setting's line, with at least one value
+static void apply_setting(Config& config, const vector<string>& words) {
+    const string& name = words[0];
+    const string& value = words[1];
+    if (name == "accounts") {
+        config.max_account = atoi(value.c_str());
+    } else if (name == "log") {
+        config.log_file = value;
+    } else if (name == "extensions") {
+        config.extensions.assign(words.begin() + 1, words.end());
+    } else if (name == "shards") {
+        config.num_shards = atoi(value.c_str());
+    } else if (name == "standby") {
+        config.with_standby = value == "yes";
+    } else if (name == "table") {
+        config.account_table = value;
+    } else if (name == "sync") {
+        config.sync_policy = value;
+    } else if (name == "log_format") {
+        config.log_format = value;
+    } else if (name == "file_cache") {
+        config.file_cache_mb = value;
+    } else if (name == "supervise") {
+        config.supervise = value == "yes";
+    }
+}
+
+// The words of a config or script line, without its comment
+static vector<string> line_words(const string& line) {
+    stringstream words(line.substr(0, line.find('#')));
+    vector<string> result;
+    string word;
+    while (words >> word) {
+        result.push_back(word);
+    }
+    return result;
+}
+
+static bool load_config(const string& path, Config& config, string& error) {
+    ifstream in(path);
+    if (!in) {
+        error = "could not open " + path;
+        return false;
+    }
+    string line;
+    for (int number = 1; getline(in, line); number++) {
+        vector<string> words = line_words(line);
+        if (words.empty()) {
+            continue;
+        }
+        if (!is_setting(words[0]) || words.size() < 2) {
+            error = "line " + to_string(number) + ": " +
+                    (is_setting(words[0]) ? words[0] + " needs a value" : "unknown setting " + words[0]);
+            return false;
+        }
+        apply_setting(config, words);
+    }
+    return true;
+}
+
+/*
+*  Batch mode (-b script, or -b - for standard input) takes the operations from a script
+*  instead of the menu, and reports how long each operation took. One line per entry;
+*  "#" starts a comment. Settings, as in a config file, may come first, followed by
+*  operations, which act as the menu entries of the same name:
+*
+*    login <user>  logout  deposit <amount>  withdraw <amount>  balance
+*    upload <file>...  download <file>...  interest <threads>  bank  audit <days>
+*    list [prefix]  stats
+*/
+struct Script {
+    struct Op {
+        int line;
+        vector<string> words; // the operation and its arguments
+    };
+    vector<Op> ops;
+};
+
+static bool load_script(const string& path, Script& script, Config& config, string& error) {
+    ifstream file_in;
+    if (path != "-") {
+        file_in.open(path);
+        if (!file_in) {
+            error = "could not open " + path;
+            return false;
+        }
+    }
+    istream& in = path == "-" ? cin : file_in;
+
+    string line;
+    for (int number = 1; getline(in, line); number++) {
+        Script::Op op = {number, line_words(line)};
+        if (op.words.empty()) {
+            continue;
+        }
+
+        const string& name = op.words[0];
+        if (is_setting(name)) {
+            if (!script.ops.empty() || op.words.size() < 2) {
+                error = "line " + to_string(number) + ": " + name +
+                        (op.words.size() < 2 ? " needs a value" : " must come before the first operation");
+                return false;
+            }
+            apply_setting(config, op.words);
+            continue;
+        }
+
+        static const vector<string> operations = {"login", "logout", "deposit", "withdraw", "balance", "upload",
+                                                  "download", "interest", "bank", "audit", "list", "stats"};
+        static const vector<string> with_argument = {"login", "deposit", "withdraw", "upload", "download",
+                                                     "interest", "audit"};
+        if (find(operations.begin(), operations.end(), name) == operations.end()) {
+            error = "line " + to_string(number) + ": unknown operation " + name;
+            return false;
+        }
+        if (op.words.size() < 2 && find(with_argument.begin(), with_argument.end(), name) != with_argument.end()) {
+            error = "line " + to_string(number) + ": " + name + " needs an argument";
+            return false;
+        }
+        script.ops.push_back(op);
+    }
+    return true;
+}
+
+/*
+*  Carries out one script operation the way its menu entry does, audit records included,
+*  but without prompts or retries. detail is filled with what the menu would have shown.
+*/
+static Response run_operation(const Script::Op& op, int& current_user, AsyncChannel<FinanceRouter>& finance,
+                              RequestChannel& file, AsyncChannel<RequestChannel>& logging, string& detail) {
+    const string& name = op.words[0];
+    const string arg = op.words.size() > 1 ? op.words[1] : "";
+    vector<string> files(op.words.begin() + 1, op.words.end());
+    auto number = [](double value) {
+        ostringstream out;
+        out << value;
+        return out.str();
+    };
+
+    if (name == "login") {
+        current_user = atoi(arg.c_str());
+        Response resp = logging.send_request(Request(LOGIN, current_user)).get();
+        if (!resp.success) {
+            current_user = -1;
+        }
+        return resp;
+    }
+    if (current_user == -1) {
+        return Response(false, 0, "", "Please login first!");
+    }
+
+    Response resp;
+    if (name == "logout") {
+        resp = logging.send_request(Request(LOGOUT, current_user)).get();
+        if (resp.success) {
+            current_user = -1;
+        }
+    } else if (name == "deposit" || name == "withdraw" || name == "balance") {
+        RequestType type = name == "deposit" ? DEPOSIT : name == "withdraw" ? WITHDRAW : BALANCE;
+        double amount = atof(arg.c_str());
+        resp = finance.send_request(Request(type, current_user, amount), [&](const Response& done) {
+            if (done.success) {
+                logging.send_oneway(Request(type, current_user, type == BALANCE ? done.balance : amount));
+            }
+        }).get();
+        if (resp.success) {
+            detail = "balance " + number(resp.balance);
+        }
+    } else if (name == "upload" || name == "download") {
+        bool uploading = name == "upload";
+        vector<Response> results;
+        if (files.size() > 1) {
+            results = uploading ? upload_batch(file, current_user, files) : download_batch(file, current_user, files);
+        } else if (uploading) {
+            ifstream in(arg, ios::binary);
+            string content((istreambuf_iterator<char>(in)), {});
+            results.push_back(in ? upload_file(file, current_user, arg, content, false)
+                                 : Response(false, 0, "", "Could not open file"));
+        } else {
+            string received;
+            results.push_back(download_file(file, current_user, arg, received));
+            if (results[0].success && !save_file(arg, received)) {
+                results[0] = Response(false, 0, "", "Could not create output file");
+            }
+        }
+        resp = Response(true, 0, "", "");
+        size_t done = 0;
+        for (size_t i = 0; i < files.size(); i++) {
+            if (results[i].success) {
+                done++;
+                logging.send_oneway(Request(uploading ? UPLOAD_FILE : DOWNLOAD_FILE, current_user, 0, files[i]));
+            } else if (resp.success) {
+                resp = results[i];
+            }
+        }
+        detail = to_string(done) + " of " + to_string(files.size()) + " file(s)";
+    } else if (name == "interest") {
+        Request request(EARN_INTEREST, current_user, atoi(arg.c_str()));
+        resp = finance.send_request(request, [&](const Response& done) {
+            if (done.success) {
+                logging.send_oneway(request);
+            }
+        }).get();
+    } else if (name == "bank") {
+        Request request(AGGREGATE, current_user);
+        resp = finance.send_request(request, [&](const Response& done) {
+            if (done.success) {
+                logging.send_oneway(request);
+            }
+        }).get();
+        if (resp.success) {
+            BankStats stats = BankStats::parse(resp.data);
+            detail = to_string(stats.active_accounts) + " accounts, total " + number(stats.total_balance);
+        }
+    } else if (name == "audit") {
+        Request query(AUDIT_QUERY, current_user);
+        int days = atoi(arg.c_str());
+        if (days > 0) {
+            int64_t now_us = chrono::duration_cast<chrono::microseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            query.data = to_string(now_us - days * 86400LL * 1000000) + ",";
+        }
+        resp = logging.send_request(query).get();
+        if (resp.success) {
+            detail = resp.message;
+            logging.send_oneway(query);
+        }
+    } else if (name == "list") {
+        Request page(LIST_FILES, current_user, 1000);
+        page.data = arg;
+        resp = file.send_request(page);
+        detail = resp.message;
+    } else if (name == "stats") {
+        resp = file.send_request(Request(STATS));
+        detail = resp.data;
+    }
+    return resp;
+}
+
+/*
+*  Runs every operation in order, printing one line each with its latency, then totals
+*  per operation. Failures are reported and the script carries on.
+*/
+static void run_script(const Script& script, AsyncChannel<FinanceRouter>& finance, RequestChannel& file,
+                       AsyncChannel<RequestChannel>& logging) {
+    struct Totals {
+        vector<double> latencies_us;
+        long failures = 0;
+    };
+    map<string, Totals> totals;
+    int current_user = -1;
+
+    auto script_start = chrono::steady_clock::now();
+    for (const Script::Op& op : script.ops) {
+        if (shutdown_requested) {
+            break;
+        }
+        string detail;
+        auto start = chrono::steady_clock::now();
+        Response resp = run_operation(op, current_user, finance, file, logging, detail);
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+        Totals& t = totals[op.words[0]];
+        t.latencies_us.push_back(us);
+        t.failures += !resp.success;
+
+        string text;
+        for (const string& word : op.words) {
+            text += (text.empty() ? "" : " ") + word;
+        }
+        cout << op.line << ": " << text << ": " << (resp.success ? "ok" : "failed") << " in " << (long)us << " us";
+        if (!resp.success) {
+            cout << " (" << resp.message << ")";
+        } else if (!detail.empty()) {
+            cout << " (" << detail << ")";
+        }
+        cout << '\n';
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - script_start).count();
+
+    cout << "\n=== Script Totals ===\n";
+    long count = 0, failures = 0;
+    for (auto& entry : totals) {
+        vector<double>& us = entry.second.latencies_us;
+        sort(us.begin(), us.end());
+        double sum = 0;
+        for (double u : us) {
+            sum += u;
+        }
+        cout << entry.first << ": " << us.size() << " ops, " << entry.second.failures << " failed, mean "
+             << (long)(sum / us.size()) << " us, p50 " << (long)us[us.size() / 2] << " us, p99 "
+             << (long)us[us.size() * 99 / 100] << " us, max " << (long)us.back() << " us\n";
+        count += us.size();
+        failures += entry.second.failures;
+    }
+    cout << count << " operations, " << failures << " failed, in " << seconds << " s ("
+         << (long)(count / max(seconds, 1e-9)) << " ops/sec)" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    string script_path; // batch mode: operations come from this script
+    bool configured = false; // the settings came from a config file, so there are no prompts
+    string error;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-S" && i + 1 < argc) {
+            config.num_shards = atoi(argv[++i]);
+        } else if (arg == "-r") {
+            config.with_standby = true;
+        } else if (arg == "-p" && i + 1 < argc) {
+            config.account_table = argv[++i];
+        } else if (arg == "-s" && i + 1 < argc) {
+            config.sync_policy = argv[++i];
+        } else if (arg == "-F" && i + 1 < argc) {
+            config.log_format = argv[++i];
+        } else if (arg == "-C" && i + 1 < argc) {
+            config.file_cache_mb = argv[++i];
+        } else if (arg == "-b" && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (arg == "-w") {
+            config.supervise = true;
+        } else if (arg == "-f" && i + 1 < argc) {
+            // Options after the config file override its settings
+            if (!load_config(argv[++i], config, error)) {
+                cerr << "Config error: " << error << endl;
+                return 1;
+            }
+            configured = true;
+        }
+    }
+
+    // A script replaces the prompts and the menu
+    Script script;
+    bool batch = !script_path.empty();
+    if (batch && !load_script(script_path, script, config, error)) {
+        cerr << "Script error: " << error << endl;
+        return 1;
+    }
+
     // Initialize signal handling
     SignalHandling::setup_handlers();
     SignalHandling::log_signal_event("Client started");
 
+    // Every answer is needed before the first server starts, so all of them can start at once
+    if (!batch && !configured) {
+        cout << "Enter the maximum account number: ";
+        cin >> config.max_account;
+        clear_input();
+
+        cout << "Enter the name of your logging file: ";
+        getline(cin, config.log_file);
+        if (config.log_file.empty()) {
+            config.log_file = "system.log";
+            cout << "Using default: " << config.log_file << endl;
+        }
+
+        int num_extensions;
+        cout << "Enter number of allowed file extensions: ";
+        cin >> num_extensions;
+        cin.ignore(); // Clear newline
+
+        // Store extensions in vector
+        config.extensions.clear();
+        cout << "Enter allowed extensions (including the dot, e.g. .txt; .txt:z stores them compressed):" << endl;
+        for(int i = 0; i < num_extensions; i++) {
+            cout << i+1 << ": ";
+            string ext;
+            getline(cin, ext);
+            if (ext.empty()) {
+                ext = ".txt";
+                cout << "Using default: " << ext << endl;
+            }
+            config.extensions.push_back(ext);
+        }
+    }
+
     // Start servers
     cout << "Starting servers..." << endl;
+    auto startup = chrono::steady_clock::now();
 
-    // finance server
-    int max_account;
-    cout << "Enter the maximum account number: ";
-    cin >> max_account;
-    clear_input();
-
-    // Start finance server
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("Fork failed");
-        exit(1);
+    // A supervised finance server recovers its accounts from a table after a restart, so
+    // one is kept for the session when none was asked for
+    bool session_table = config.supervise && config.account_table.empty();
+    if (session_table) {
+        config.account_table = "session.table";
     }
-    if (pid == 0) { // Child process
-        char* args[] = {(char*)"./finance", (char*)"-m", (char*)to_string(max_account).c_str(), nullptr};
-        execvp(args[0], args);
-        perror("Execvp failed");
-        exit(1);
+
+    // Every server is started with fixed arguments, which a restart reuses
+    vector<pair<string, vector<string>>> server_args;
+
+    // Start one finance server per shard, each owning a range of account ids,
+    // plus a hot standby for each shard if requested
+    FinanceRouter finance(config.max_account, config.num_shards, config.with_standby);
+    vector<string> table_paths;
+    for (FinanceRouter::Shard& shard : finance.get_shards()) {
+        vector<pair<string, vector<string>>> instances = {{shard.name, {}}};
+        if (!shard.standby_name.empty()) {
+            instances[0].second = {"-r", shard.replication_name};
+            instances.push_back({shard.standby_name, {"-R", shard.replication_name}});
+        }
+
+        for (auto& instance : instances) {
+            const string& name = instance.first;
+            vector<string> finance_args = {"./finance", "-m", to_string(shard.last_id)};
+            if (name != "finance") {
+                finance_args.insert(finance_args.end(), {"-l", to_string(shard.first_id), "-n", name});
+            }
+            finance_args.insert(finance_args.end(), instance.second.begin(), instance.second.end());
+            if (name == shard.name && !shard.notify_name.empty()) {
+                finance_args.push_back("-N");
+            }
+            if (!config.account_table.empty()) {
+                table_paths.push_back(name == "finance" ? config.account_table : config.account_table + "." + name);
+                finance_args.push_back("-p");
+                finance_args.push_back(table_paths.back());
+            }
+            if (!config.sync_policy.empty()) {
+                finance_args.push_back("-s");
+                finance_args.push_back(config.sync_policy);
+            }
+            server_args.push_back({name, finance_args});
+        }
     }
-    
-    // Register finance server with signal handler
-    SignalHandling::register_server(pid, "finance");
 
     // logging server
-    string log_file_name;
-    cout << "Enter the name of your logging file: ";
-    getline(cin, log_file_name);
-    if (log_file_name.empty()) {
-        log_file_name = "system.log";
-        cout << "Using default: " << log_file_name << endl;
-    }
+    server_args.push_back({"logging", {"./logging", "-f", config.log_file, "-F", config.log_format}});
 
-    pid = fork();
-    if (pid < 0) {
-        perror("Fork failed");
-        exit(1);
+    // file server, with the allowed extensions as its arguments
+    vector<string> file_args = {"./file"};
+    if (!config.file_cache_mb.empty()) {
+        file_args.insert(file_args.end(), {"-C", config.file_cache_mb});
     }
-    if (pid == 0) { // Child process
-        char* args[] = {(char*)"./logging", (char*)"-f", (char*)log_file_name.c_str(), nullptr};
-        execvp(args[0], args);
-        perror("Execvp failed");
-        exit(1);
+    file_args.insert(file_args.end(), config.extensions.begin(), config.extensions.end());
+    server_args.push_back({"file", file_args});
+
+    for (auto& server : server_args) {
+        if (spawn_server(server.first, server.second) < 0) {
+            exit(1);
+        }
     }
     
-    // Register logging server with signal handler
-    SignalHandling::register_server(pid, "logging");
-
-    // file server
-    cout << "Enter number of allowed file extensions: ";
-    int num_extensions;
-    cin >> num_extensions;
-    cin.ignore(); // Clear newline
-
-    // Store extensions in vector
-    vector<string> extensions;
-    cout << "Enter allowed extensions (including the dot, e.g. .txt):" << endl;
-    for(int i = 0; i < num_extensions; i++) {
-        cout << i+1 << ": ";
-        string ext;
-        getline(cin, ext);
-        if (ext.empty()) {
-            ext = ".txt";
-            cout << "Using default: " << ext << endl;
-        }
-        extensions.push_back(ext);
-    }
-
-    // Create argument array for file server
-    char** file_args = new char*[num_extensions + 2]; // +2 for program name and NULL
-    file_args[0] = (char*)"./file";
-    
-    // Fill with pointers to the extension strings
-    for(int i = 0; i < num_extensions; i++) {
-        file_args[i + 1] = (char*)extensions[i].c_str();
-    }
-    file_args[num_extensions + 1] = NULL;
+    // Opening a channel waits until its server has opened the other end, so the channels
+    // are opened together and the client is ready as soon as the slowest server is
+    finance.set_supervised(config.supervise);
+    unique_ptr<RequestChannel> file_channel, logging_channel;
+    thread file_open([&file_channel] {
+        file_channel.reset(new RequestChannel("file", RequestChannel::CLIENT_SIDE));
+    });
+    thread logging_open([&logging_channel] {
+        logging_channel.reset(new RequestChannel("logging", RequestChannel::CLIENT_SIDE));
+    });
+    finance.connect();
+    file_open.join();
+    logging_open.join();
+    RequestChannel& file = *file_channel;
+    RequestChannel& logging = *logging_channel;
 
-    pid_t file_pid = fork();
-    if (file_pid < 0) {
-        perror("Fork failed");
-        exit(1);
-    }
-    if (file_pid == 0) {
-        execvp(file_args[0], file_args);
-        perror("File server exec failed");
-        exit(1);
+    double ready_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - startup).count();
+    cout << "Servers ready in " << ready_ms << " ms" << endl;
+    log_signal_event("Servers ready in " + to_string(ready_ms) + " ms");
+
+    // Servers that die are restarted and their channels reopened. Shards with a standby
+    // fail over instead, since their replication channel cannot be rebuilt.
+    Supervisor supervisor;
+    if (config.supervise) {
+        for (auto& server : server_args) {
+            vector<RequestChannel*> channels;
+            if (server.first == "file") {
+                channels = {&file};
+            } else if (server.first == "logging") {
+                channels = {&logging};
+            }
+            for (FinanceRouter::Shard& shard : finance.get_shards()) {
+                if (shard.name == server.first && !shard.standby) {
+                    channels = {shard.channel.get()};
+                    if (shard.notify) {
+                        channels.push_back(shard.notify.get());
+                    }
+                }
+            }
+            if (!channels.empty()) {
+                supervisor.watch(server.first, server.second, channels);
+            }
+        }
+        supervisor.start();
     }
-    
-    // Register file server with signal handler
-    SignalHandling::register_server(file_pid, "file");
 
-    delete[] file_args;
-    
-    // Give servers time to start
-    cout << "Waiting for servers to start..." << endl;
-    sleep(1);
-    
-    // Create RequestChannels for each server
-    RequestChannel finance("finance", RequestChannel::CLIENT_SIDE);
-    RequestChannel file("file", RequestChannel::CLIENT_SIDE);
-    RequestChannel logging("logging", RequestChannel::CLIENT_SIDE);
+    // Finance and logging requests go out from workers of their own, so an audit record is
+    // sent as soon as its transaction is confirmed, without the user waiting for it. The
+    // workers start with SIGINT blocked, leaving it to the menu's critical sections.
+    block_signals();
+    AsyncChannel<FinanceRouter> finance_calls(finance);
+    AsyncChannel<RequestChannel> logging_calls(logging);
+    unblock_signals();
 
     int current_user = -1;  // -1 means no user logged in
-    bool running = true;
+    bool running = !batch;
+    if (batch) {
+        run_script(script, finance_calls, file, logging_calls);
+    }
     
     while (running && !shutdown_requested) {
         print_menu();
@@ -220,15 +898,9 @@ int main() {
                     // Login with timeout (10 seconds)
                     auto login_operation = [&]() {
                         Request login(LOGIN, current_user);
-                        Response resp;
-
-                        
-                        bool success = execute_with_timeout([&]() {
-                            resp = logging.send_request(login);
-                            return true;
-                        }, 10);
+                        Response resp = logging_calls.send_request(login, nullptr, 10).get();
                         
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "Login timed out after 10 seconds." << endl;
                             return false;
                         }
@@ -269,27 +941,20 @@ int main() {
                     // Deposit with timeout (30 seconds)
                     auto deposit_operation = [&]() {
                         Request txn(DEPOSIT, current_user, amount);
-                        Response resp;
-                        
-                        bool success = execute_with_timeout([&]() {
-                            resp = finance.send_request(txn);
-                            return true;
-                        }, 30);
+                        // Log the deposit as soon as the finance server confirms it
+                        Response resp = finance_calls.send_request(txn, [&](const Response& done) {
+                            if (done.success) {
+                                logging_calls.send_oneway(Request(DEPOSIT, current_user, amount));
+                            }
+                        }, 30).get();
                         
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "Deposit timed out after 30 seconds." << endl;
                             return false;
                         }
                         
                         if (resp.success) {
                             cout << "Deposit successful. New balance: " << resp.balance << endl;
-                            
-                            // Log the deposit
-                            Request audit(DEPOSIT, current_user, amount);
-                            Response log_resp = logging.send_request(audit);
-                            if (!log_resp.success) {
-                                cout << "Warning: Failed to log transaction" << endl;
-                            }
                             return true;
                         } else {
                             cout << "Deposit failed: " << resp.message << endl;
@@ -322,27 +987,20 @@ int main() {
                     // Withdraw with timeout (30 seconds)
                     auto withdraw_operation = [&]() {
                         Request txn(WITHDRAW, current_user, amount);
-                        Response resp;
-                        
-                        bool success = execute_with_timeout([&]() {
-                            resp = finance.send_request(txn);
-                            return true;
-                        }, 30);
+                        // Log the withdrawal as soon as the finance server confirms it
+                        Response resp = finance_calls.send_request(txn, [&](const Response& done) {
+                            if (done.success) {
+                                logging_calls.send_oneway(Request(WITHDRAW, current_user, amount));
+                            }
+                        }, 30).get();
                         
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "Withdrawal timed out after 30 seconds." << endl;
                             return false;
                         }
                         
                         if (resp.success) {
                             cout << "Withdrawal successful. New balance: " << resp.balance << endl;
-                            
-                            // Log the withdrawal
-                            Request audit(WITHDRAW, current_user, amount);
-                            Response log_resp = logging.send_request(audit);
-                            if (!log_resp.success) {
-                                cout << "Warning: Failed to log transaction" << endl;
-                            }
                             return true;
                         } else {
                             cout << "Withdrawal failed: " << resp.message << endl;
@@ -372,27 +1030,20 @@ int main() {
                     // View balance with timeout (15 seconds)
                     auto balance_operation = [&]() {
                         Request txn(BALANCE, current_user);
-                        Response resp;
-
-                        bool success = execute_with_timeout([&]() {
-                            resp = finance.send_request(txn);
-                            return true;
-                        }, 15);
+                        // Log the balance view as soon as the finance server answers
+                        Response resp = finance_calls.send_request(txn, [&](const Response& done) {
+                            if (done.success) {
+                                logging_calls.send_oneway(Request(BALANCE, current_user, done.balance));
+                            }
+                        }, 15).get();
                         
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "Balance request timed out after 15 seconds." << endl;
                             return false;
                         }
                         
                         if (resp.success) {
                             cout << "Current balance: " << resp.balance << endl;
-                            
-                            // Log the balance view
-                            Request audit(BALANCE, current_user, resp.balance);
-                            Response log_resp = logging.send_request(audit);
-                            if (!log_resp.success) {
-                                cout << "Warning: Failed to log transaction" << endl;
-                            }
                             return true;
                         } else {
                             cout << "Failed to get balance: " << resp.message << endl;
@@ -431,17 +1082,13 @@ int main() {
                     string content((istreambuf_iterator<char>(infile)), {});
                     infile.close();
 
-                    // Upload file with timeout (60 seconds)
+                    // Upload file with timeout (60 seconds); a retry resumes where the last attempt stopped
+                    bool resume = false;
                     auto upload_operation = [&]() {
-                        Request upload(UPLOAD_FILE, current_user, 0, filename, content);
-                        Response resp;
-                        
-                        bool success = execute_with_timeout([&]() {
-                            resp = file.send_request(upload);
-                            return true;
-                        }, 60);
+                        Response resp = upload_file(file, current_user, filename, content, resume, 60);
+                        resume = true;
                         
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "File upload timed out after 60 seconds." << endl;
                             return false;
                         }
@@ -451,10 +1098,7 @@ int main() {
                             
                             // Log the file upload
                             Request audit(UPLOAD_FILE, current_user, 0, filename);
-                            Response log_resp = logging.send_request(audit);
-                            if (!log_resp.success) {
-                                cout << "Warning: Failed to log file upload" << endl;
-                            }
+                            logging_calls.send_oneway(audit);
                             return true;
                         } else {
                             cout << "File upload failed: " << resp.message << endl;
@@ -484,17 +1128,12 @@ int main() {
                     cout << "Enter filename to download: ";
                     getline(cin, filename);
                     
-                    // Download file with timeout (60 seconds)
+                    // Download file with timeout (60 seconds); a retry keeps what already arrived
+                    string received;
                     auto download_operation = [&]() {
-                        Request download(DOWNLOAD_FILE, current_user, 0, filename);
-                        Response resp;
+                        Response resp = download_file(file, current_user, filename, received, 60);
                         
-                        bool success = execute_with_timeout([&]() {
-                            resp = file.send_request(download);
-                            return true;
-                        }, 60);
-                        
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "File download timed out after 60 seconds." << endl;
                             return false;
                         }
@@ -505,16 +1144,13 @@ int main() {
                                 cout << "Error: Could not create output file\n";
                                 return false;
                             }
-                            outfile << resp.data;
+                            outfile << received;
                             outfile.close();
                             cout << "File downloaded successfully\n";
                             
                             // Log the file download
                             Request audit(DOWNLOAD_FILE, current_user, 0, filename);
-                            Response log_resp = logging.send_request(audit);
-                            if (!log_resp.success) {
-                                cout << "Warning: Failed to log file download" << endl;
-                            }
+                            logging_calls.send_oneway(audit);
                             return true;
                         } else {
                             cout << "File download failed: " << resp.message << endl;
@@ -543,14 +1179,9 @@ int main() {
                     // Logout with timeout (10 seconds)
                     auto logout_operation = [&]() {
                         Request logout(LOGOUT, current_user);
-                        Response resp;
-                        
-                        bool success = execute_with_timeout([&]() {
-                            resp = logging.send_request(logout);
-                            return true;
-                        }, 10);
+                        Response resp = logging_calls.send_request(logout, nullptr, 10).get();
                         
-                        if (!success) {
+                        if (resp.timed_out) {
                             cout << "Logout timed out after 10 seconds." << endl;
                             return false;
                         }
@@ -579,6 +1210,35 @@ int main() {
                 
                 case 8: { 
                     SignalHandling::print_server_status();
+                    // Audit records are sent one-way, so failures only show up here
+                    long lost_audits = logging.get_oneway_failures();
+                    if (lost_audits > 0) {
+                        cout << "Warning: " << lost_audits << " audit record(s) could not be delivered to logging" << endl;
+                    }
+                    for (const Supervisor::Stats& stats : supervisor.get_stats()) {
+                        if (stats.restarts > 0 || stats.failures > 0) {
+                            cout << stats.name << ": restarted " << stats.restarts << " time(s), time to recover last "
+                                 << stats.last_ms << " ms, mean " << stats.total_ms / max(stats.restarts, 1)
+                                 << " ms, max " << stats.max_ms << " ms"
+                                 << (stats.failures > 0 ? ", could not be restarted" : "") << endl;
+                        }
+                    }
+                    uint64_t cache_hits, cache_misses;
+                    if (finance.cache_stats(cache_hits, cache_misses)) {
+                        cout << "Balance cache: " << cache_hits << " hits, " << cache_misses << " misses" << endl;
+                    }
+
+                    Response stats = file.send_request(Request(STATS));
+                    if (stats.success) {
+                        // Counters come back as name=value pairs
+                        cout << "File server:";
+                        stringstream fields(stats.data);
+                        string field;
+                        while (getline(fields, field, ';')) {
+                            cout << " " << field;
+                        }
+                        cout << endl;
+                    }
                     break;
                 }
                 
@@ -594,22 +1254,188 @@ int main() {
 
                     Request request(EARN_INTEREST, current_user, numThreads);
                     Response resp;
-                    resp = finance.send_request(request);
+                    resp = finance_calls.send_request(request, [&](const Response& done) {
+                        if (done.success) {
+                            logging_calls.send_oneway(request);
+                        }
+                    }).get();
 
                     if (!resp.success) {
-                        cout << "Interest update failed" << endl;
+                        cout << "Interest update failed: " << resp.message << endl;
                     } else {
                         cout << "Interest update successful!" << endl;
-                            
-                        Response log_resp = logging.send_request(request);
-                        if (!log_resp.success) {
-                            cout << "Warning: Failed to log transaction" << endl;
-                        }
                     }
 
                     break;
                 }
                 
+                case 10: {  // Bank-wide statistics
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    Request request(AGGREGATE, current_user);
+                    Response resp = finance_calls.send_request(request, [&](const Response& done) {
+                        if (done.success) {
+                            logging_calls.send_oneway(request);
+                        }
+                    }).get();
+
+                    if (!resp.success) {
+                        cout << "Failed to get bank statistics: " << resp.message << endl;
+                        break;
+                    }
+
+                    BankStats stats = BankStats::parse(resp.data);
+                    cout << "\n=== Bank Statistics ===\n"
+                         << "Active accounts: " << stats.active_accounts << "\n"
+                         << "Total deposits: " << stats.total_balance << "\n"
+                         << "Balance distribution:\n";
+                    for (int i = 0; i < BankStats::NUM_BANDS; i++) {
+                        cout << "  " << BankStats::band_label(i) << ": " << stats.bands[i] << "\n";
+                    }
+                    break;
+                }
+
+                case 11: {  // Audit history of the current user
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    int days;
+                    cout << "Show how many days back (0 for all): ";
+                    cin >> days;
+                    clear_input();
+
+                    // The logging server answers from its index; an empty bound means open-ended
+                    Request query(AUDIT_QUERY, current_user);
+                    if (days > 0) {
+                        int64_t now_us = chrono::duration_cast<chrono::microseconds>(
+                            chrono::system_clock::now().time_since_epoch()).count();
+                        query.data = to_string(now_us - days * 86400LL * 1000000) + ",";
+                    }
+                    Response resp = logging_calls.send_request(query, [&](const Response& done) {
+                        if (done.success) {
+                            logging_calls.send_oneway(query);
+                        }
+                    }).get();
+
+                    if (!resp.success) {
+                        cout << "Failed to get audit history: " << resp.message << endl;
+                        break;
+                    }
+
+                    cout << "\n=== Audit History (" << resp.message << ") ===\n";
+                    if (!resp.data.empty()) {
+                        cout << resp.data << "\n";
+                    }
+                    break;
+                }
+
+                case 12: {  // Stored files, from the file server's index
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    string prefix;
+                    cout << "List files starting with (empty for all): ";
+                    getline(cin, prefix);
+
+                    // Fetched a page at a time, each continuing after the last name seen
+                    const int page_size = 100;
+                    Request page(LIST_FILES, current_user, page_size);
+                    page.data = prefix;
+                    size_t listed = 0;
+                    cout << "\n=== Stored Files ===\n";
+                    while (true) {
+                        Response resp = file.send_request(page);
+                        if (!resp.success) {
+                            cout << "Failed to list files: " << resp.message << endl;
+                            break;
+                        }
+                        stringstream lines(resp.data);
+                        uint64_t size;
+                        int owner;
+                        time_t mtime;
+                        string name;
+                        while (lines >> size >> owner >> mtime && lines.get() == ' ' && getline(lines, name)) {
+                            char when[32];
+                            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&mtime));
+                            cout << name << "  " << size << " bytes  user " << owner << "  " << when << "\n";
+                            page.filename = name;
+                            listed++;
+                        }
+                        if (resp.balance < page_size) {
+                            break;
+                        }
+                    }
+                    cout << listed << " file(s)" << endl;
+                    break;
+                }
+
+                case 13: {  // Several files in one pipelined session
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    char direction;
+                    cout << "Upload or download (u/d): ";
+                    cin >> direction;
+                    clear_input();
+                    bool uploading = tolower(direction) == 'u';
+
+                    string line;
+                    cout << "Enter file names separated by spaces (a directory takes every file in it; "
+                         << "end it with / when downloading): ";
+                    getline(cin, line);
+
+                    vector<string> filenames;
+                    stringstream words(line);
+                    string word;
+                    while (words >> word) {
+                        struct stat st;
+                        vector<string> found;
+                        if (uploading && stat(word.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                            found = list_local_files(word);
+                        } else if (!uploading && word.back() == '/') {
+                            found = list_stored_files(file, current_user, word);
+                        } else {
+                            found.push_back(word);
+                        }
+                        filenames.insert(filenames.end(), found.begin(), found.end());
+                    }
+                    if (filenames.empty()) {
+                        cout << "No files to transfer\n";
+                        break;
+                    }
+
+                    block_signals();
+                    auto start = chrono::steady_clock::now();
+                    vector<Response> results = uploading ? upload_batch(file, current_user, filenames)
+                                                         : download_batch(file, current_user, filenames);
+                    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                    unblock_signals();
+
+                    size_t done = 0;
+                    for (size_t i = 0; i < filenames.size(); i++) {
+                        if (!results[i].success) {
+                            cout << "  " << filenames[i] << ": failed: " << results[i].message << "\n";
+                            continue;
+                        }
+                        cout << "  " << filenames[i] << ": " << (uploading ? "uploaded" : "downloaded") << "\n";
+                        done++;
+                        Request audit(uploading ? UPLOAD_FILE : DOWNLOAD_FILE, current_user, 0, filenames[i]);
+                        logging_calls.send_oneway(audit);
+                    }
+                    cout << done << " of " << filenames.size() << " file(s) " << (uploading ? "uploaded" : "downloaded")
+                         << " in " << ms << " ms" << endl;
+                    break;
+                }
+
                 default:
                     cout << "Invalid choice. Please try again.\n";
             }
@@ -628,48 +1454,55 @@ int main() {
         log_signal_event("Normal exit requested");
     }
 
+    // Servers are about to exit on purpose, so they must not be restarted
+    supervisor.stop();
+    for (const Supervisor::Stats& stats : supervisor.get_stats()) {
+        if (stats.restarts > 0) {
+            log_signal_event(stats.name + " was restarted " + to_string(stats.restarts) + " time(s), mean time to recover " +
+                             to_string(stats.total_ms / stats.restarts) + " ms, max " + to_string(stats.max_ms) + " ms");
+        }
+    }
+
     // Cleanup - send QUIT to all servers with timeout
     cout << "Sending shutdown signals to servers..." << endl;
     log_signal_event("Sending QUIT to all servers");
 
+    // The three QUITs go out together, so shutdown waits for the slowest server rather than
+    // for all of them in turn. Anything still queued for finance or logging is sent first.
+    // Each QUIT has a deadline of its own, so a hung server cannot hold up the others.
     Request quit(QUIT);
-    SignalHandling::timeout_occurred = false;
+    future<Response> finance_quit = finance_calls.send_request(quit, nullptr, 3);
+    future<Response> logging_quit = logging_calls.send_request(quit, nullptr, 3);
 
-    // Try to send QUIT to finance with 3-second timeout
-    SignalHandling::wait_with_timeout(3);
     try {
-        finance.send_request(quit);
-        log_signal_event("QUIT sent to finance server");
+        file.send_request(quit, 3);
+        log_signal_event("QUIT sent to file server");
     } catch (const exception& e) {
-        log_signal_event("Failed to send QUIT to finance server: " + string(e.what()));
+        log_signal_event("Failed to send QUIT to file server: " + string(e.what()));
     }
-    SignalHandling::cancel_timeout();
-
-    // Try to send QUIT to file with 3-second timeout
-    SignalHandling::wait_with_timeout(3);
     try {
-        file.send_request(quit);
-        log_signal_event("QUIT sent to file server");
+        finance_quit.get();
+        log_signal_event("QUIT sent to finance server");
     } catch (const exception& e) {
-        log_signal_event("Failed to send QUIT to file server: " + string(e.what()));
+        log_signal_event("Failed to send QUIT to finance server: " + string(e.what()));
     }
-    SignalHandling::cancel_timeout();
-
-    // Try to send QUIT to logging with 3-second timeout
-    SignalHandling::wait_with_timeout(3);
     try {
-        logging.send_request(quit);
+        logging_quit.get();
         log_signal_event("QUIT sent to logging server");
     } catch (const exception& e) {
         log_signal_event("Failed to send QUIT to logging server: " + string(e.what()));
     }
-    SignalHandling::cancel_timeout();
     
     // Wait for all child processes
     cout << "Waiting for all child processes to terminate..." << endl;
     log_signal_event("Waiting for child processes");
     while(wait(NULL) > 0);
     log_signal_event("All child processes terminated");
+    if (session_table) {
+        for (const string& path : table_paths) {
+            unlink(path.c_str());
+        }
+    }
     
     log_signal_event("Client shutdown complete");
     cout << "Shutdown complete.\n";
@@ -1,31 +1,136 @@
 #include "common.h"
 #include <vector>
 #include <string>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
 
-Request Request::parseRequest(const std::string& buffer) {
+// Splits buffer on '|' into at most max_parts fields; the last field keeps any further '|'
+static std::vector<std::string> split_fields(const std::string& buffer, size_t max_parts) {
     std::vector<std::string> parts;
-    size_t pos = 0;
-    std::string str = buffer;
-    const std::string delimiter = "|";
-    
-    while ((pos = str.find(delimiter)) != std::string::npos) {
-        parts.push_back(str.substr(0, pos));
-        str.erase(0, pos + delimiter.length());
+    size_t start = 0;
+    size_t pos;
+    while (parts.size() + 1 < max_parts && (pos = buffer.find('|', start)) != std::string::npos) {
+        parts.push_back(buffer.substr(start, pos - start));
+        start = pos + 1;
     }
-    parts.push_back(str);
+    parts.push_back(buffer.substr(start));
+    return parts;
+}
+
+std::string Request::serialize() const {
+    std::stringstream ss;
+    ss << std::setprecision(17)
+       << static_cast<int>(type) << "|"
+       << user_id << "|"
+       << amount << "|"
+       << filename << "|"
+       << offset << "|"
+       << length << "|"
+       << data;
+    return ss.str();
+}
 
-    if (parts.size() < 5) {
+Request Request::parseRequest(const std::string& buffer) {
+    std::vector<std::string> parts = split_fields(buffer, 7);
+
+    if (parts.size() < 7) {
         return Request(QUIT); // Return a default QUIT request if parsing fails
     }
 
-    int type = std::stoi(parts[0]);
+    // stoi and friends throw on a field that is not a number; that is malformed too
+    try {
+        int type = std::stoi(parts[0]);
 
-    if (type < 0 || type > 8) {
+        if (type < 0 || type >= NUM_REQUEST_TYPES) {
+            return Request(QUIT); // Return a default QUIT request if parsing fails
+        }
+        
+        int user_id = std::stoi(parts[1]);
+        double amount = std::stod(parts[2]);
+        
+        Request r(static_cast<RequestType>(type), user_id, amount, parts[3], parts[6]);
+        r.offset = std::stoull(parts[4]);
+        r.length = std::stoull(parts[5]);
+        return r;
+    } catch (const std::logic_error&) {
         return Request(QUIT); // Return a default QUIT request if parsing fails
     }
-    
-    int user_id = std::stoi(parts[1]);
-    double amount = std::stod(parts[2]);
-    
-    return Request(static_cast<RequestType>(type), user_id, amount, parts[3], parts[4]);
-}
\ No newline at end of file
+}
+
+std::string Response::serialize() const {
+    std::stringstream ss;
+    ss << std::setprecision(17)
+       << (success ? "1" : "0") << "|"
+       << balance << "|"
+       << message << "|"
+       << data;
+    return ss.str();
+}
+
+Response Response::parseResponse(const std::string& buffer) {
+    std::vector<std::string> parts = split_fields(buffer, 4);
+    Response resp;
+    if (parts.size() < 4) {
+        return resp;
+    }
+    try {
+        resp.balance = std::stod(parts[1]);
+    } catch (const std::logic_error&) {
+        return resp;
+    }
+    resp.success = (parts[0] == "1");
+    resp.message = parts[2];
+    resp.data = parts[3];
+    return resp;
+}
+
+void BankStats::add(double balance) {
+    total_balance += balance;
+    active_accounts++;
+
+    int band = 0;
+    for (double limit = 1.0; band < NUM_BANDS - 1 && balance >= limit; limit *= 10) {
+        band++;
+    }
+    bands[band]++;
+}
+
+BankStats& BankStats::merge(const BankStats& other) {
+    total_balance += other.total_balance;
+    active_accounts += other.active_accounts;
+    for (int i = 0; i < NUM_BANDS; i++) {
+        bands[i] += other.bands[i];
+    }
+    return *this;
+}
+
+// Format: total;active;band0,band1,...  (no '|', which delimits response fields)
+std::string BankStats::serialize() const {
+    std::stringstream ss;
+    ss << std::setprecision(17) << total_balance << ";" << active_accounts << ";";
+    for (int i = 0; i < NUM_BANDS; i++) {
+        ss << (i ? "," : "") << bands[i];
+    }
+    return ss.str();
+}
+
+BankStats BankStats::parse(const std::string& data) {
+    BankStats stats;
+    std::stringstream ss(data);
+    char sep;
+    if (!(ss >> stats.total_balance >> sep >> stats.active_accounts >> sep)) {
+        return BankStats();
+    }
+    for (int i = 0; i < NUM_BANDS && ss >> stats.bands[i]; i++) {
+        ss >> sep;
+    }
+    return stats;
+}
+
+std::string BankStats::band_label(int band) {
+    if (band == 0) return "[0, 1)";
+    std::string low = "1" + std::string(band - 1, '0');
+    if (band == NUM_BANDS - 1) return "[" + low + ", inf)";
+    return "[" + low + ", " + low + "0)";
+}
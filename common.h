@@ -3,6 +3,8 @@
 
 #include <string>
 #include <chrono>
+#include <vector>
+#include <cstdint>
 
 enum RequestType {
     QUIT,
@@ -13,7 +15,13 @@ enum RequestType {
     DOWNLOAD_FILE,
     LOGIN,
     LOGOUT,
-    EARN_INTEREST // new option
+    EARN_INTEREST, // new option
+    AGGREGATE,     // bank-wide statistics
+    AUDIT_QUERY,   // audit history of user_id; data = "from_us,to_us", amount = record limit
+    STATS,         // server counters, as "name=value;..." in data
+    FILE_SIZE,     // stored size and partial upload progress of filename, as "size=N;partial=M;..."
+    LIST_FILES,    // stored files whose names start with data; amount = limit, filename = page after
+    NUM_REQUEST_TYPES
 };
 
 struct Request {
@@ -22,12 +30,20 @@ struct Request {
     double amount;
     std::string filename;
     std::string data;
+    // File ranges: DOWNLOAD_FILE reads length bytes from offset (0 = to the end) and the
+    // response's balance is the whole file's size; an UPLOAD_FILE with length set is one
+    // chunk, at offset, of a file of length bytes
+    uint64_t offset;
+    uint64_t length;
+    bool oneway; // sent with RequestChannel::send_oneway; no response is expected
 
     Request(RequestType t, int uid = 0, double amt = 0.0, 
             std::string fname = "", std::string d = "") : 
             type(t), user_id(uid), amount(amt), 
-            filename(fname), data(d) {}
+            filename(fname), data(d), offset(0), length(0), oneway(false) {}
 
+    // Wire format: type|user_id|amount|filename|offset|length|data (data may contain anything)
+    std::string serialize() const;
     static Request parseRequest(const std::string& buffer);
 };
 
@@ -36,10 +52,33 @@ struct Response {
     double balance;
     std::string data;
     std::string message;
+    bool timed_out; // set by RequestChannel when no response arrived in time; not sent
 
     Response(bool s = false, double b = 0.0, 
             std::string d = "", std::string m = "") :
-            success(s), balance(b), data(d), message(m) {}
+            success(s), balance(b), data(d), message(m), timed_out(false) {}
+
+    // Wire format: success|balance|message|data (data last so it may contain '|')
+    std::string serialize() const;
+    static Response parseResponse(const std::string& buffer);
+};
+
+// Bank-wide statistics carried in the data field of an AGGREGATE response
+struct BankStats {
+    // Balances are bucketed by order of magnitude: [0,1), [1,10), ..., [1e6,inf)
+    static const int NUM_BANDS = 8;
+
+    double total_balance;
+    long active_accounts;
+    std::vector<long> bands;
+
+    BankStats() : total_balance(0.0), active_accounts(0), bands(NUM_BANDS, 0) {}
+
+    void add(double balance);
+    BankStats& merge(const BankStats& other);
+    std::string serialize() const;
+    static BankStats parse(const std::string& data);
+    static std::string band_label(int band);
 };
 
 #endif
\ No newline at end of file
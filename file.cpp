@@ -1,101 +1,480 @@
 #include "common.h"
 #include "channel.h"
-#include <fstream>
+#include "file_cache.h"
+#include "blob_store.h"
+#include "block_codec.h"
+#include "file_lock.h"
+#include "thread_pool.h"
+#include <cstdio>
 #include <iostream>
-#include <sstream>
 #include <vector>
+#include <thread>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
 
 using namespace std;
 
-int main(int argc, char* argv[]) {
+// Reads a whole file; false if it could not be read
+static bool read_file(int fd, size_t length, string& contents) {
+    contents.resize(length);
+    size_t got = 0;
+    while (got < length) {
+        ssize_t n = pread(fd, &contents[got], length - got, got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+/*
+*  State shared by every channel. Requests are received on one thread per channel and
+*  carried out on the I/O pool, which bounds how many transfers touch the disk at once.
+*  Transfers of the same file are ordered by its lock; different files overlap.
+*/
+struct FileServer {
     vector<string> allowed_extensions;
-    
-    // Get allowed extensions from command line arguments
-    for (int i = 1; i < argc; i++) {
-        allowed_extensions.push_back(argv[i]);
+    vector<string> compressed_extensions; // stored block-compressed (see block_codec.h)
+    bool compress_all = false;
+    unique_ptr<FileCache> cache;
+    unique_ptr<BlobStore> store;
+    unique_ptr<ThreadPool> io;
+    FileLockTable locks;
+};
+
+static bool extension_allowed(const FileServer& server, const string& filename, Response& resp) {
+    // Check file extension if extensions were provided
+    if (server.allowed_extensions.empty()) {
+        return true;
+    }
+    size_t dot_pos = filename.find_last_of(".");
+    if (dot_pos == string::npos) {
+        resp.success = false;
+        resp.message = "File has no extension";
+        return false;
     }
-    
-    RequestChannel channel("file", RequestChannel::SERVER_SIDE);
 
-    if (system("mkdir -p storage") != 0) {
-        cout << "Error creating storage directory" << endl;
-        return 1;
+    string ext = filename.substr(dot_pos);
+    for (const string& allowed_ext : server.allowed_extensions) {
+        if (ext == allowed_ext) {
+            return true;
+        }
     }
+    resp.success = false;
+    resp.message = "File extension not allowed";
+    return false;
+}
 
-    while (true) {
-        Request r = channel.receive_request(0);
+static bool should_compress(const FileServer& server, const string& filename) {
+    if (server.compress_all) {
+        return true;
+    }
+    size_t dot_pos = filename.find_last_of(".");
+    return dot_pos != string::npos &&
+           find(server.compressed_extensions.begin(), server.compressed_extensions.end(),
+                filename.substr(dot_pos)) != server.compressed_extensions.end();
+}
 
-        if (r.type == QUIT) {
-            Response resp(true, 0, "", "Server shutting down");
-            channel.send_response(resp);
-            exit(0);
+// Where an upload sent in chunks collects until its last chunk arrives. Names with
+// directories in them are kept flat, with '/' (and '%') escaped.
+static string partial_path(const string& filename) {
+    string path = "storage/partial/";
+    for (char c : filename) {
+        path += c == '/' ? "%2F" : c == '%' ? "%25" : string(1, c);
+    }
+    return path;
+}
+
+static off_t file_size(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) ? st.st_size : -1;
+}
+
+// Path of the stored copy of filename, or empty if there is none
+static string stored_path(FileServer& server, const string& filename) {
+    return server.store->path_of(filename);
+}
+
+/*
+*  Moves files stored before deduplication, which sit under storage/ by name, into the
+*  blob store, so every name is looked up in the index and no other path under storage/
+*  can be reached by asking for it. A name the index already has is newer than the old
+*  copy, which is just removed. Run once at startup, before any request is served.
+*/
+static void migrate_legacy_files(FileServer& server, const string& dir, const string& prefix) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        string name = entry->d_name;
+        if (name == "." || name == ".." || (prefix.empty() && (name == "blobs" || name == "partial"))) {
+            continue;
+        }
+        string path = dir + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            migrate_legacy_files(server, path, prefix + name + "/");
+            rmdir(path.c_str());
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            continue;
         }
 
-        Response resp;
-        resp.success = true;
-        
-        if (r.type == UPLOAD_FILE) {
-            // Check file extension if extensions were provided
-            if (!allowed_extensions.empty()) {
-                size_t dot_pos = r.filename.find_last_of(".");
-                if (dot_pos == string::npos) {
-                    resp.success = false;
-                    resp.message = "File has no extension";
-                    channel.send_response(resp);
-                    continue;
-                }
-
-                string ext = r.filename.substr(dot_pos);
-                bool allowed = false;
-                for (const string& allowed_ext : allowed_extensions) {
-                    if (ext == allowed_ext) {
-                        allowed = true;
-                        break;
-                    }
-                }
-                
-                if (!allowed) {
-                    resp.success = false;
-                    resp.message = "File extension not allowed";
-                    channel.send_response(resp);
-                    continue;
-                }
-            }
-            
-            string filepath = "storage/" + r.filename;
-            ofstream outfile(filepath);
-            
-            if (!outfile) {
-                resp.success = false;
-                resp.message = "Failed to create file";
-            } else {
-                outfile << r.data;
-                outfile.close();
-                resp.message = "File uploaded successfully";
+        string filename = prefix + name;
+        string contents, error;
+        bool moved = !server.store->path_of(filename).empty();
+        if (!moved) {
+            int fd = open(path.c_str(), O_RDONLY);
+            moved = fd >= 0 && read_file(fd, st.st_size, contents) &&
+                    server.store->put(filename, contents, error, should_compress(server, filename));
+            if (fd >= 0) {
+                close(fd);
             }
         }
-        else if (r.type == DOWNLOAD_FILE) {
-            string filepath = "storage/" + r.filename;
-            ifstream infile(filepath);
-            
-            if (!infile) {
-                resp.success = false;
-                resp.message = "File not found";
-            } else {
-                stringstream buffer;
-                buffer << infile.rdbuf();
-                resp.data = buffer.str();
-                resp.message = "File downloaded successfully";
-                infile.close();
-            }
+        if (moved) {
+            unlink(path.c_str());
+        } else {
+            cerr << "Could not move " << path << " into the blob store" << (error.empty() ? "" : ": " + error) << endl;
+        }
+    }
+    closedir(d);
+}
+
+// Size of filename as uploaded, whether or not it is stored compressed; -1 if missing
+static off_t stored_size(FileServer& server, const string& filename) {
+    int fd = open(stored_path(server, filename).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    BlockReader reader;
+    struct stat st;
+    off_t size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && reader.open(fd) ? (off_t)reader.size() : -1;
+    close(fd);
+    return size;
+}
+
+/*
+*  One chunk of an upload of r.length bytes. Chunks must arrive in order; a chunk at
+*  offset 0 starts over. FILE_SIZE tells a client that lost its connection where to
+*  resume. The last chunk moves the assembled file into the blob store.
+*/
+static void upload_chunk(FileServer& server, const Request& r, Response& resp) {
+    string path = partial_path(r.filename);
+    off_t have = max((off_t)0, file_size(path));
+    if (r.offset != (uint64_t)have && r.offset != 0) {
+        resp.success = false;
+        resp.message = "Upload offset mismatch, server has " + to_string(have) + " bytes";
+        return;
+    }
+    if (r.offset + r.data.size() > r.length) {
+        resp.success = false;
+        resp.message = "Chunk goes past the end of the file";
+        return;
+    }
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | (r.offset == 0 ? O_TRUNC : 0), 0644);
+    size_t written = 0;
+    while (fd >= 0 && written < r.data.size()) {
+        ssize_t n = pwrite(fd, r.data.data() + written, r.data.size() - written, r.offset + written);
+        if (n < 0) {
+            break;
         }
-        else {
+        written += n;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (written < r.data.size()) {
+        resp.success = false;
+        resp.message = "Failed to create file";
+        return;
+    }
+    if (r.offset + r.data.size() < r.length) {
+        resp.message = "Chunk stored";
+        return;
+    }
+
+    string contents;
+    fd = open(path.c_str(), O_RDONLY);
+    bool complete = fd >= 0 && read_file(fd, r.length, contents);
+    if (fd >= 0) {
+        close(fd);
+    }
+    string error;
+    if (!complete || !server.store->put(r.filename, contents, error, should_compress(server, r.filename), r.user_id)) {
+        resp.success = false;
+        resp.message = complete ? error : "Failed to read uploaded chunks";
+        return;
+    }
+    unlink(path.c_str());
+    server.cache->invalidate(r.filename);
+    resp.message = "File uploaded successfully";
+}
+
+static void upload(FileServer& server, RequestChannel& channel, const Request& r) {
+    Response resp(true);
+    if (extension_allowed(server, r.filename, resp)) {
+        FileLockTable::Guard guard(server.locks, r.filename, true);
+        string error;
+        if (r.length > 0) {
+            upload_chunk(server, r, resp);
+        } else if (!server.store->put(r.filename, r.data, error, should_compress(server, r.filename), r.user_id)) {
             resp.success = false;
-            resp.message = "Unknown RequestType";
+            resp.message = error;
+        } else {
+            unlink(partial_path(r.filename).c_str());
+            server.cache->invalidate(r.filename);
+            resp.message = "File uploaded successfully";
         }
+    }
+    channel.send_response(resp);
+}
 
-        channel.send_response(resp);
+// Clamps the requested range to the file; false if it starts past the end
+static bool clamp_range(const Request& r, size_t size, size_t& length) {
+    if (r.offset > size) {
+        return false;
+    }
+    length = size - r.offset;
+    if (r.length > 0 && r.length < length) {
+        length = r.length;
     }
+    return true;
+}
+
+static void download(FileServer& server, RequestChannel& channel, const Request& r) {
+    Response resp(true, 0, "", "File downloaded successfully");
+    FileLockTable::Guard guard(server.locks, r.filename, false);
+    size_t length;
+
+    FileCache::Contents cached = server.cache->get(r.filename);
+    if (cached) {
+        resp.balance = cached->size();
+        if (!clamp_range(r, cached->size(), length)) {
+            channel.send_response(Response(false, resp.balance, "", "Offset is past the end of the file"));
+        } else if (length == cached->size()) {
+            channel.send_data_response(resp, *cached);
+        } else {
+            channel.send_data_response(resp, cached->substr(r.offset, length));
+        }
+        return;
+    }
+
+    int fd = open(stored_path(server, r.filename).c_str(), O_RDONLY);
+    struct stat st;
+    BlockReader reader;
     
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        channel.send_response(Response(false, 0, "", "File not found"));
+    } else if (!reader.open(fd)) {
+        channel.send_response(Response(false, 0, "", "Failed to read file"));
+    } else if (!clamp_range(r, reader.size(), length)) {
+        channel.send_response(Response(false, reader.size(), "", "Offset is past the end of the file"));
+    } else if (reader.size() <= server.cache->max_entry_bytes()) {
+        // Small enough to keep (decompressed) for the next download
+        shared_ptr<string> contents = make_shared<string>();
+        resp.balance = reader.size();
+        if (reader.read(0, reader.size(), *contents)) {
+            server.cache->put(r.filename, contents);
+            channel.send_data_response(resp, length == contents->size() ? *contents
+                                                                        : contents->substr(r.offset, length));
+        } else {
+            channel.send_response(Response(false, 0, "", "Failed to read file"));
+        }
+    } else if (!reader.is_compressed()) {
+        // The file goes from the page cache to the channel without passing through here
+        resp.balance = reader.size();
+        channel.send_file_response(resp, fd, r.offset, length);
+    } else {
+        // Inflate one block at a time as the channel drains, starting at the requested offset
+        resp.balance = reader.size();
+        uint64_t pos = r.offset;
+        channel.send_stream_response(resp, length, [&](string& chunk) {
+            size_t block = pos / reader.get_block_size();
+            if (block >= reader.num_blocks() || !reader.read_block(block, chunk)) {
+                return false;
+            }
+            chunk.erase(0, pos - (uint64_t)block * reader.get_block_size());
+            pos += chunk.size();
+            return true;
+        });
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Answered from the store's index; only files stored before it existed are opened
+static Response query_size(FileServer& server, const Request& r) {
+    FileLockTable::Guard guard(server.locks, r.filename, false);
+    BlobStore::FileInfo info;
+    bool indexed = server.store->info(r.filename, info);
+    off_t size = indexed ? (off_t)info.size : stored_size(server, r.filename);
+    off_t partial = max((off_t)0, file_size(partial_path(r.filename)));
+    string data = "size=" + to_string(size) + ";partial=" + to_string(partial);
+    if (indexed) {
+        data += ";hash=" + info.blob + ";owner=" + to_string(info.owner) + ";mtime=" + to_string(info.mtime) +
+                ";stored=" + to_string(info.disk_size);
+    }
+    return Response(true, size, data, size < 0 ? "File not found" : "File found");
+}
+
+/*
+*  Lists stored files whose names start with data, at most amount of them (100 if not
+*  given), after the name in filename so a long listing can be paged. One line per file:
+*  "<size> <owner> <mtime> <name>".
+*/
+static Response list_files(FileServer& server, const Request& r) {
+    size_t limit = r.amount > 0 ? (size_t)r.amount : 100;
+    auto files = server.store->list(r.data, limit, r.filename);
+    string lines;
+    for (const auto& file : files) {
+        lines += to_string(file.second.size) + " " + to_string(file.second.owner) + " " +
+                 to_string(file.second.mtime) + " " + file.first + "\n";
+    }
+    return Response(true, files.size(), lines, to_string(files.size()) + " file(s)");
+}
+
+static Response stats(FileServer& server) {
+    Response resp(true, 0, "", "File server statistics");
+    FileCache& cache = *server.cache;
+    BlobStore::Stats stored = server.store->stats();
+    char ratio[32], compression[32];
+    snprintf(ratio, sizeof(ratio), "%.2f",
+             stored.stored_bytes ? (double)stored.logical_bytes / stored.stored_bytes : 1.0);
+    snprintf(compression, sizeof(compression), "%.2f",
+             stored.disk_bytes ? (double)stored.stored_bytes / stored.disk_bytes : 1.0);
+    resp.data = "cache_hits=" + to_string(cache.hits()) + ";cache_misses=" + to_string(cache.misses()) +
+                ";cache_files=" + to_string(cache.entries()) + ";cache_bytes=" + to_string(cache.bytes()) +
+                ";files=" + to_string(stored.files) + ";blobs=" + to_string(stored.blobs) +
+                ";logical_bytes=" + to_string(stored.logical_bytes) +
+                ";stored_bytes=" + to_string(stored.stored_bytes) +
+                ";dedup_hits=" + to_string(stored.dedup_hits) + ";dedup_ratio=" + ratio +
+                ";disk_bytes=" + to_string(stored.disk_bytes) + ";compression_ratio=" + compression;
+    return resp;
+}
+
+static void handle_request(FileServer& server, RequestChannel& channel, const Request& r) {
+    if (r.type == UPLOAD_FILE) {
+        upload(server, channel, r);
+    } else if (r.type == DOWNLOAD_FILE) {
+        download(server, channel, r);
+    } else if (r.type == STATS) {
+        channel.send_response(stats(server));
+    } else if (r.type == FILE_SIZE) {
+        channel.send_response(query_size(server, r));
+    } else if (r.type == LIST_FILES) {
+        channel.send_response(list_files(server, r));
+    } else {
+        channel.send_response(Response(false, 0, "", "Unknown RequestType"));
+    }
+}
+
+// Asks the kernel to start reading a file that is about to be downloaded
+static void prefetch(FileServer& server, const Request& r) {
+    int fd = open(stored_path(server, r.filename).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    BlockReader reader;
+    if (reader.open(fd) && !reader.is_compressed()) {
+        posix_fadvise(fd, r.offset, r.length, POSIX_FADV_WILLNEED);
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+}
+
+/*
+*  Serves one client channel. A QUIT on the primary channel shuts the whole server down;
+*  on any other channel it only closes that channel.
+*
+*  Responses go out in the order requests arrived, one at a time, but a client that
+*  pipelines its requests gets the next one read, and its file prefetched, while the
+*  previous one is still being carried out.
+*/
+static void serve(FileServer& server, const string& channel_name, bool primary) {
+    RequestChannel channel(channel_name, RequestChannel::SERVER_SIDE);
+    future<void> in_flight;
+
+    while (true) {
+        shared_ptr<Request> r = make_shared<Request>(channel.receive_request(0));
+        if (r->type == DOWNLOAD_FILE) {
+            prefetch(server, *r);
+        }
+        if (in_flight.valid()) {
+            in_flight.get();
+        }
+
+        if (r->type == QUIT) {
+            Response resp(true, 0, "", primary ? "Server shutting down" : "Channel closed");
+            channel.send_response(resp);
+            if (!primary) {
+                return;
+            }
+            exit(0);
+        }
+
+        in_flight = server.io->submit([&server, &channel, r] { handle_request(server, channel, *r); });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    FileServer server;
+    size_t cache_mb = 64;
+    int num_channels = 1;
+    int io_workers = 4;
+    
+    // Options first, then the allowed extensions
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-C" && i + 1 < argc) {
+            // Download cache budget in megabytes; 0 disables it
+            cache_mb = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-c" && i + 1 < argc) {
+            num_channels = max(1, atoi(argv[++i]));
+        } else if (arg == "-w" && i + 1 < argc) {
+            io_workers = max(1, atoi(argv[++i]));
+        } else if (arg == "-z") {
+            // Compress every stored file
+            server.compress_all = true;
+        } else if (arg.size() > 2 && arg.compare(arg.size() - 2, 2, ":z") == 0) {
+            // An extension such as ".txt:z" is allowed and stored compressed
+            arg.resize(arg.size() - 2);
+            server.allowed_extensions.push_back(arg);
+            server.compressed_extensions.push_back(arg);
+        } else {
+            server.allowed_extensions.push_back(arg);
+        }
+    }
+
+    if (system("mkdir -p storage/partial") != 0) {
+        cout << "Error creating storage directory" << endl;
+        return 1;
+    }
+    server.cache.reset(new FileCache(cache_mb * 1024 * 1024));
+    // Uploads are stored once per distinct content; names map to blobs
+    server.store.reset(new BlobStore("storage"));
+    migrate_legacy_files(server, "storage", "");
+    server.io.reset(new ThreadPool(io_workers));
+
+    // Extra channels are served alongside the primary one
+    vector<thread> receivers;
+    for (int i = 1; i < num_channels; i++) {
+        receivers.emplace_back(serve, std::ref(server), RequestChannel::channel_name("file", i), false);
+    }
+    serve(server, "file", true);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,73 @@
+#include "file_cache.h"
+
+using namespace std;
+
+FileCache::FileCache(size_t budget_bytes) :
+    budget(budget_bytes), used(0), hit_count(0), miss_count(0) {}
+
+FileCache::Contents FileCache::get(const string& filename) {
+    lock_guard<mutex> lock(cacheMutex);
+    auto it = index.find(filename);
+    if (it == index.end()) {
+        miss_count++;
+        return Contents();
+    }
+    hit_count++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->contents;
+}
+
+void FileCache::put(const string& filename, Contents contents) {
+    if (!contents || contents->size() > max_entry_bytes()) {
+        return;
+    }
+    lock_guard<mutex> lock(cacheMutex);
+    auto it = index.find(filename);
+    if (it != index.end()) {
+        used -= it->second->contents->size();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+    evict_to(budget - contents->size());
+    lru.push_front(Entry{filename, contents});
+    index[filename] = lru.begin();
+    used += contents->size();
+}
+
+void FileCache::invalidate(const string& filename) {
+    lock_guard<mutex> lock(cacheMutex);
+    auto it = index.find(filename);
+    if (it != index.end()) {
+        used -= it->second->contents->size();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+}
+
+void FileCache::evict_to(size_t target) {
+    while (used > target && !lru.empty()) {
+        used -= lru.back().contents->size();
+        index.erase(lru.back().filename);
+        lru.pop_back();
+    }
+}
+
+uint64_t FileCache::hits() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return hit_count;
+}
+
+uint64_t FileCache::misses() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return miss_count;
+}
+
+size_t FileCache::entries() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return lru.size();
+}
+
+size_t FileCache::bytes() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return used;
+}
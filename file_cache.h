@@ -0,0 +1,52 @@
+#ifndef _FILE_CACHE_H_
+#define _FILE_CACHE_H_
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+/*
+*  Contents of recently downloaded files, kept within a byte budget and evicted least
+*  recently used first. Entries are shared and immutable, so a reader keeps its copy
+*  alive even if the file is invalidated or evicted while it is being sent. Files larger
+*  than an eighth of the budget are never cached; they would flush everything else out.
+*/
+class FileCache {
+public:
+    typedef std::shared_ptr<const std::string> Contents;
+
+    explicit FileCache(size_t budget_bytes);
+
+    // Counts a hit or a miss; a miss returns null
+    Contents get(const std::string& filename);
+    void put(const std::string& filename, Contents contents);
+    // Called when a file changes, so the next download rereads it
+    void invalidate(const std::string& filename);
+
+    size_t max_entry_bytes() const { return budget / 8; }
+    uint64_t hits() const;
+    uint64_t misses() const;
+    size_t entries() const;
+    size_t bytes() const;
+
+private:
+    struct Entry {
+        std::string filename;
+        Contents contents;
+    };
+
+    size_t budget;
+    size_t used;
+    uint64_t hit_count;
+    uint64_t miss_count;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    mutable std::mutex cacheMutex;
+
+    void evict_to(size_t target);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "file_lock.h"
+
+using namespace std;
+
+pthread_rwlock_t* FileLockTable::acquire(const string& filename) {
+    lock_guard<mutex> lock(tableMutex);
+    Entry*& entry = entries[filename];
+    if (!entry) {
+        entry = new Entry;
+        pthread_rwlock_init(&entry->lock, nullptr);
+        entry->users = 0;
+    }
+    entry->users++;
+    return &entry->lock;
+}
+
+void FileLockTable::release(const string& filename) {
+    lock_guard<mutex> lock(tableMutex);
+    auto it = entries.find(filename);
+    if (--it->second->users == 0) {
+        pthread_rwlock_destroy(&it->second->lock);
+        delete it->second;
+        entries.erase(it);
+    }
+}
+
+FileLockTable::Guard::Guard(FileLockTable& _table, const string& _filename, bool exclusive) :
+    table(_table), filename(_filename), lock(_table.acquire(_filename)) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+}
+
+FileLockTable::Guard::~Guard() {
+    pthread_rwlock_unlock(lock);
+    table.release(filename);
+}
@@ -0,0 +1,41 @@
+#ifndef _FILE_LOCK_H_
+#define _FILE_LOCK_H_
+
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+/*
+*  Reader/writer locks by filename: downloads of a file share it, an upload has it to
+*  itself, and transfers of different files never wait for each other. A lock exists
+*  only while someone holds or waits for it, so the table stays as small as the number
+*  of files being transferred.
+*/
+class FileLockTable {
+public:
+    class Guard {
+    public:
+        Guard(FileLockTable& table, const std::string& filename, bool exclusive);
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        FileLockTable& table;
+        std::string filename;
+        pthread_rwlock_t* lock;
+    };
+
+private:
+    struct Entry {
+        pthread_rwlock_t lock;
+        int users;
+    };
+    std::unordered_map<std::string, Entry*> entries;
+    std::mutex tableMutex;
+
+    pthread_rwlock_t* acquire(const std::string& filename);
+    void release(const std::string& filename);
+};
+
+#endif
@@ -1,111 +1,590 @@
 #include "common.h"
 #include "channel.h"
 #include "thread_pool.h"
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <csignal>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <type_traits>
 
 using namespace std;
 
+/*
+*  Each account carries a sequence counter (seqlock). Writers make it odd for the
+*  duration of an update, which also keeps other writers out of the account.
+*  Readers never write to the account: they retry until they observe the same even
+*  counter before and after copying the fields.
+*/
 class Account {
 public:
+    std::atomic<unsigned> seq;
     int id;
-    double balance;
-    bool active;
-    Account() : id(-1), balance(0.0), active(false) {} 
-    Account(int _id) : id(_id), balance(0.0), active(true) {}
+    std::atomic<double> balance;
+    std::atomic<bool> active;
+    Account() : seq(0), id(-1), balance(0.0), active(false) {}
+
+    // Writer side, usable with std::lock_guard
+    void lock() {
+        unsigned s = seq.load(std::memory_order_relaxed);
+        while ((s & 1) || !seq.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+            std::this_thread::yield();
+            s = seq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void unlock() {
+        seq.fetch_add(1, std::memory_order_release);
+    }
+
+    // Must be called with the writer lock held
+    void open(int _id) {
+        if (!active.load(std::memory_order_relaxed)) {
+            id = _id;
+            balance.store(0.0, std::memory_order_relaxed);
+            active.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // Reader side: a consistent (active, balance) pair without taking the lock
+    double read_balance(bool* is_active = nullptr) const {
+        while (true) {
+            unsigned before = seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            double b = balance.load(std::memory_order_relaxed);
+            bool a = active.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == before) {
+                if (is_active) *is_active = a;
+                return b;
+            }
+        }
+    }
+};
+
+// Accounts are read straight out of the mapped file, where all-zero bytes mean an inactive account
+static_assert(std::is_standard_layout<Account>::value, "Account must have standard layout");
+
+// How often dirty pages of a mapped account table are pushed to disk
+enum SyncPolicy {
+    SYNC_NONE,  // leave write-back to the kernel
+    SYNC_ASYNC, // schedule write-back after every mutation (MS_ASYNC)
+    SYNC_FULL   // wait for write-back after every mutation (MS_SYNC)
+};
+
+// Header stored in front of the account array in the mapped file
+struct TableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t account_size;
+    int64_t capacity;
+};
+
+static const char TABLE_MAGIC[8] = {'F', 'I', 'N', 'T', 'A', 'B', 'L', 'E'};
+static const uint32_t TABLE_VERSION = 2;
+
+struct AccountTable {
+    Account* accounts = nullptr;
+    int capacity = 0;
+    char* map_base = nullptr; // nullptr when the table lives on the heap
+    size_t map_len = 0;
+    SyncPolicy policy = SYNC_NONE;
 };
 
+/*
+*  Maps <path> as the account table, creating or growing it to hold <capacity> accounts.
+*  An existing table is reused as-is, so a restarted server sees every balance again.
+*  Returns false (with errno set by the failing call) if the file cannot be used.
+*/
+bool map_account_table(AccountTable& table, const string& path, int capacity) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+
+    TableHeader header;
+    bool fresh = (size_t)st.st_size < sizeof(TableHeader);
+    if (!fresh) {
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            memcmp(header.magic, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0 ||
+            header.version != TABLE_VERSION || header.account_size != sizeof(Account)) {
+            cerr << "Account table " << path << " has an incompatible format" << endl;
+            close(fd);
+            errno = EINVAL;
+            return false;
+        }
+        // Never shrink a table that already holds accounts
+        if (header.capacity > capacity) {
+            capacity = header.capacity;
+        }
+    }
+
+    size_t len = sizeof(TableHeader) + (size_t)capacity * sizeof(Account);
+    if ((size_t)st.st_size < len && ftruncate(fd, len) < 0) {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    // Newly added space reads back as zeros, which is an inactive account
+    memcpy(header.magic, TABLE_MAGIC, sizeof(TABLE_MAGIC));
+    header.version = TABLE_VERSION;
+    header.account_size = sizeof(Account);
+    header.capacity = capacity;
+    memcpy(base, &header, sizeof(header));
+
+    table.map_base = static_cast<char*>(base);
+    table.map_len = len;
+    table.accounts = reinterpret_cast<Account*>(table.map_base + sizeof(TableHeader));
+    table.capacity = capacity;
+
+    // A crash in the middle of an update leaves its counter odd; release those writers
+    for (int i = 0; i < capacity; i++) {
+        if (table.accounts[i].seq.load(std::memory_order_relaxed) & 1) {
+            table.accounts[i].seq.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+/*
+*  Pushes accounts [first, first + count) to disk according to the table's sync policy.
+*  msync works on whole pages, so the range is widened to page boundaries.
+*/
+void sync_account_table(const AccountTable& table, int first, int count, bool force = false) {
+    if (!table.map_base || (table.policy == SYNC_NONE && !force)) {
+        return;
+    }
+
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(table.accounts + first);
+    uintptr_t end = reinterpret_cast<uintptr_t>(table.accounts + first + count);
+    begin &= ~(page - 1);
+
+    int flags = (table.policy == SYNC_ASYNC && !force) ? MS_ASYNC : MS_SYNC;
+    if (msync(reinterpret_cast<void*>(begin), end - begin, flags) < 0) {
+        perror("msync failed");
+    }
+}
+
 void applyInterest(Account& account) {
     // TODO: if the account is acctive and the balance is positive, then increase the account's balance by 1%
     // otherwise, just return without modification
-    if (account.active && account.balance > 0) {
-        account.balance *= 1.01;
+    std::lock_guard<Account> guard(account);
+    double balance = account.balance.load(std::memory_order_relaxed);
+    if (account.active.load(std::memory_order_relaxed) && balance > 0) {
+        account.balance.store(balance * 1.01, std::memory_order_relaxed);
     }
     return;
 }
 
-int main(int argc, char* argv[]) {
-    int max_accounts = 100;
-    
-    // Parse command line arguments
-    for(int i = 1; i < argc; i++) {
-        string arg = argv[i];
-        if(arg == "-m" && i + 1 < argc) {
-            max_accounts = atoi(argv[++i]) + 1;
+struct FinanceServer {
+    AccountTable table;
+    int max_accounts;
+    int first_id; // a shard owns user ids [first_id, first_id + max_accounts)
+
+    // Hot standby fed with every mutation, in the order the mutations were applied
+    bool replicated = false;
+    std::unique_ptr<RequestChannel> replica;
+    std::mutex replica_mutex;
+
+    // Every change to a balance gets the next change number, and responses carry the
+    // number they reflect in their data. With -N, each client channel also gets a
+    // <channel>-notify channel on which the changes are pushed as they happen.
+    std::atomic<uint64_t> changes{0};
+    bool notifying = false;
+    struct Listener {
+        std::unique_ptr<RequestChannel> channel;
+        bool missed; // a push was dropped, so the next one invalidates everything instead
+    };
+    std::vector<Listener> notify_channels;
+    std::mutex notifyMutex;
+    std::condition_variable notifyMissed; // wakes retry_missed_notifies
+};
+
+/*
+*  Pushes a change to every notify channel: a BALANCE request with the account's new
+*  balance as its amount, or EARN_INTEREST when every balance changed. The change number
+*  goes in data. Channels whose client has gone away are dropped.
+*
+*  The pushes never wait: a client that is not keeping up has its push dropped, and its
+*  next one is an EARN_INTEREST, which makes it forget every balance it was not told of.
+*  retry_missed_notifies sends that EARN_INTEREST if no other change comes along first.
+*/
+void notify_change(FinanceServer& server, Request note, uint64_t version) {
+    if (!server.notifying) {
+        return;
+    }
+    note.data = to_string(version);
+    Request invalidate(EARN_INTEREST, server.first_id, 0, "", note.data);
+    std::lock_guard<std::mutex> lock(server.notifyMutex);
+    auto it = server.notify_channels.begin();
+    while (it != server.notify_channels.end()) {
+        if (it->channel->send_oneway(it->missed ? invalidate : note)) {
+            it->missed = false;
+            ++it;
+        } else if (errno == EAGAIN) {
+            it->missed = true;
+            server.notifyMissed.notify_one();
+            ++it;
+        } else {
+            it = server.notify_channels.erase(it);
         }
     }
-    
-    RequestChannel channel("finance", RequestChannel::SERVER_SIDE);
-    Account* accounts = new Account[max_accounts];
-    
-    while (true) {
-        Request r = channel.receive_request(0);
+}
 
-        if (r.type == QUIT) {
-            Response resp(true, 0, "", "Server shutting down");
-            channel.send_response(resp);
-            //
-            delete[] accounts;
-            exit(0);
+/*
+*  Resends the EARN_INTEREST owed to every client whose push was dropped, every few
+*  milliseconds until it gets through. Without it the client would keep serving the
+*  balances it missed until some other account changed, so a client is now at most
+*  its own backlog plus one retry interval behind.
+*/
+void retry_missed_notifies(FinanceServer& server) {
+    const auto interval = std::chrono::milliseconds(2);
+    auto any_missed = [&server] {
+        for (const FinanceServer::Listener& listener : server.notify_channels) {
+            if (listener.missed) {
+                return true;
+            }
+        }
+        return false;
+    };
+    std::unique_lock<std::mutex> lock(server.notifyMutex);
+    while (true) {
+        server.notifyMissed.wait(lock, any_missed);
+        // Give the client a moment to drain its channel; a change in the meantime may
+        // deliver the invalidation instead
+        server.notifyMissed.wait_for(lock, interval, [] { return false; });
+        Request invalidate(EARN_INTEREST, server.first_id, 0, "", to_string(server.changes.load()));
+        auto it = server.notify_channels.begin();
+        while (it != server.notify_channels.end()) {
+            if (!it->missed || it->channel->send_oneway(invalidate)) {
+                it->missed = false;
+                ++it;
+            } else if (errno == EAGAIN) {
+                ++it;
+            } else {
+                it = server.notify_channels.erase(it);
+            }
         }
+    }
+}
 
-        Response resp;
-        resp.success = true;
+// Applies one request to the account table and builds its response
+Response handle_request(FinanceServer& server, const Request& r) {
+    Account* accounts = server.table.accounts;
+    int max_accounts = server.max_accounts;
+    int first_id = server.first_id;
 
-        if (r.user_id < 0 || r.user_id >= max_accounts) {
-            resp.success = false;
-            resp.message = "Invalid account ID";
-            channel.send_response(resp);
-            continue;
-        }
-
-        // Create account if it doesn't exist
-        if (!accounts[r.user_id].active) {
-            accounts[r.user_id] = Account(r.user_id);
-        }
-
-        Account& acc = accounts[r.user_id];
-        
-        if (r.type == DEPOSIT) {
-            acc.balance += r.amount;
-            resp.balance = acc.balance;
-            resp.message = "Deposit successful";
-        } 
-        else if (r.type == WITHDRAW) {
-            if (acc.balance >= r.amount) {
-                acc.balance -= r.amount;
-                resp.balance = acc.balance;
-                resp.message = "Withdrawal successful";
-            } else {
-                resp.success = false;
-                resp.message = "Insufficient funds";
+    Response resp;
+    resp.success = true;
+
+    int index = r.user_id - first_id;
+    if (index < 0 || index >= max_accounts) {
+        resp.success = false;
+        resp.message = "Invalid account ID";
+        return resp;
+    }
+
+    Account& acc = accounts[index];
+    
+    // Numbered while the account is still locked, so an account's changes are numbered in
+    // the order they were applied
+    uint64_t version = 0;
+    if (r.type == DEPOSIT) {
+        {
+            std::lock_guard<Account> guard(acc);
+            // Create account if it doesn't exist
+            acc.open(r.user_id);
+            resp.balance = acc.balance.load(std::memory_order_relaxed) + r.amount;
+            acc.balance.store(resp.balance, std::memory_order_relaxed);
+            version = ++server.changes;
+        }
+        sync_account_table(server.table, index, 1);
+        resp.message = "Deposit successful";
+        resp.data = to_string(version);
+        notify_change(server, Request(BALANCE, r.user_id, resp.balance), version);
+    } 
+    else if (r.type == WITHDRAW) {
+        bool withdrawn = false;
+        {
+            std::lock_guard<Account> guard(acc);
+            acc.open(r.user_id);
+            double balance = acc.balance.load(std::memory_order_relaxed);
+            if (balance >= r.amount) {
+                resp.balance = balance - r.amount;
+                acc.balance.store(resp.balance, std::memory_order_relaxed);
+                withdrawn = true;
+                version = ++server.changes;
             }
         }
-        else if (r.type == BALANCE) {
-            resp.balance = acc.balance;
-            resp.message = "View balance successful";
+        if (withdrawn) {
+            sync_account_table(server.table, index, 1);
+            resp.message = "Withdrawal successful";
+            resp.data = to_string(version);
+            notify_change(server, Request(BALANCE, r.user_id, resp.balance), version);
+        } else {
+            resp.success = false;
+            resp.message = "Insufficient funds";
         }
-        else if (r.type == EARN_INTEREST) {
-            try {
-                int numThreads = 2;
-                if (r.amount > 0) numThreads = r.amount;
-                // TODO: Create a ThreadPool and add all tasks to it
+    }
+    else if (r.type == BALANCE) {
+        // An account that was never opened reads as a zero balance. The change number is
+        // taken first, so the balance reflects at least every change up to it.
+        version = server.changes.load();
+        resp.balance = acc.read_balance();
+        resp.message = "View balance successful";
+        resp.data = to_string(version);
+    }
+    else if (r.type == EARN_INTEREST) {
+        try {
+            int numThreads = 2;
+            if (r.amount > 0) numThreads = r.amount;
+            // TODO: Create a ThreadPool and add all tasks to it
+            {
                 ThreadPool tp(numThreads);
                 for (int i = 0; i < max_accounts; ++i) {
                     tp.enqueue(std::bind(applyInterest, std::ref(accounts[i])));
                 }
-
-            } catch (const std::exception& e) {
-                // TODO: Add error handling and set the response to have a false success value
-                resp.success = false;
-                //std::cerr << "Error creating ThreadPool: " << e.what() << std::endl;
-                resp.message = "Error applying interest: " + std::string(e.what());
             }
+            sync_account_table(server.table, 0, max_accounts);
+
+            // Numbered after the sweep, so every change numbered before it may be stale
+            version = ++server.changes;
+            resp.data = to_string(version);
+            notify_change(server, Request(EARN_INTEREST, first_id), version);
+        } catch (const std::exception& e) {
+            // TODO: Add error handling and set the response to have a false success value
+            resp.success = false;
+            //std::cerr << "Error creating ThreadPool: " << e.what() << std::endl;
+            resp.message = "Error applying interest: " + std::string(e.what());
         }
-        else {
+    }
+    else if (r.type == AGGREGATE) {
+        try {
+            int numThreads = std::max(1u, std::thread::hardware_concurrency());
+            if (r.amount > 0) numThreads = r.amount;
+            ThreadPool tp(numThreads);
+            BankStats stats = tp.parallel_reduce(0, max_accounts, BankStats(),
+                [accounts](size_t lo, size_t hi) {
+                    BankStats chunk;
+                    for (size_t i = lo; i < hi; ++i) {
+                        bool active;
+                        double balance = accounts[i].read_balance(&active);
+                        if (active) chunk.add(balance);
+                    }
+                    return chunk;
+                },
+                [](BankStats a, const BankStats& b) { return a.merge(b); });
+            resp.balance = stats.total_balance;
+            resp.data = stats.serialize();
+            resp.message = "Aggregate successful";
+        } catch (const std::exception& e) {
             resp.success = false;
-            resp.message = "Unknown RequestType";
+            resp.message = "Error computing aggregate: " + std::string(e.what());
         }
+    }
+    else {
+        resp.success = false;
+        resp.message = "Unknown RequestType";
+    }
+
+    return resp;
+}
+
+bool is_mutation(RequestType type) {
+    return type == DEPOSIT || type == WITHDRAW || type == EARN_INTEREST;
+}
 
+/*
+*  Applies a mutation and forwards it to the standby before the client hears back.
+*  Mutations are serialised while a standby is attached so it replays them in exactly
+*  the order they were applied here; the standby runs the same code on the same
+*  inputs, so it ends up with the same balances. Reads are not affected.
+*/
+Response replicate_request(FinanceServer& server, const Request& r) {
+    std::lock_guard<std::mutex> lock(server.replica_mutex);
+    Response resp = handle_request(server, r);
+    if (server.replica) {
+        Response ack = server.replica->send_request(r, 0);
+        if (ack.message.empty()) {
+            cerr << "Lost connection to standby, continuing without replication" << endl;
+            server.replica.reset();
+        }
+    }
+    return resp;
+}
+
+/*
+*  Serves one client channel. Several channels can be served at once: point updates
+*  only lock the account they touch, and BALANCE never takes a lock at all.
+*  A QUIT on the primary channel shuts the whole server down.
+*/
+void serve(FinanceServer& server, const string& channel_name, bool primary) {
+    RequestChannel channel(channel_name, RequestChannel::SERVER_SIDE);
+    if (server.notifying) {
+        // The client opens its end of the notify channel right after this one
+        std::unique_ptr<RequestChannel> notify(new RequestChannel(channel_name + "-notify", RequestChannel::CLIENT_SIDE));
+        notify->set_nonblocking_writes();
+        // After a restart the client may hold balances that the previous process changed
+        // without getting to push them, so it starts over
+        bool sent = notify->send_oneway(Request(EARN_INTEREST, server.first_id, 0, "", to_string(++server.changes)));
+        std::lock_guard<std::mutex> lock(server.notifyMutex);
+        server.notify_channels.push_back({std::move(notify), !sent});
+        if (!sent) {
+            server.notifyMissed.notify_one();
+        }
+    }
+    
+    while (true) {
+        Request r = channel.receive_request(0);
+
+        if (r.type == QUIT) {
+            Response resp(true, 0, "", primary ? "Server shutting down" : "Channel closed");
+            channel.send_response(resp);
+            if (!primary) {
+                return;
+            }
+            // Other channels may still be running, so only flush; exit() unmaps the table
+            sync_account_table(server.table, 0, server.table.capacity, true);
+            exit(0);
+        }
+
+        Response resp = is_mutation(r.type) && server.replicated ? replicate_request(server, r)
+                                                                  : handle_request(server, r);
         channel.send_response(resp);
     }
+}
+
+/*
+*  Standby side of replication: applies the primary's mutation stream as it arrives.
+*  When the primary goes away the stream ends and this server keeps serving clients
+*  with the state it has, ready to take over.
+*/
+void follow_primary(FinanceServer& server, const string& channel_name) {
+    RequestChannel channel(channel_name, RequestChannel::SERVER_SIDE);
+
+    while (true) {
+        Request r = channel.receive_request(0);
+        if (r.type == QUIT) {
+            cerr << "Replication stream from primary ended" << endl;
+            return;
+        }
+        handle_request(server, r);
+        channel.send_response(Response(true, 0, "", "Applied"));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int max_accounts = 100;
+    int first_id = 0;
+    int num_channels = 1;
+    string name = "finance";
+    string table_path;
+    string replica_name, primary_name;
+    SyncPolicy sync_policy = SYNC_NONE;
+    bool notifying = false;
+    
+    // Parse command line arguments
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "-m" && i + 1 < argc) {
+            max_accounts = atoi(argv[++i]) + 1;
+        }
+        else if(arg == "-l" && i + 1 < argc) {
+            first_id = atoi(argv[++i]);
+        }
+        else if(arg == "-n" && i + 1 < argc) {
+            name = argv[++i];
+        }
+        else if(arg == "-c" && i + 1 < argc) {
+            num_channels = max(1, atoi(argv[++i]));
+        }
+        else if(arg == "-r" && i + 1 < argc) {
+            replica_name = argv[++i];
+        }
+        else if(arg == "-R" && i + 1 < argc) {
+            primary_name = argv[++i];
+        }
+        else if(arg == "-N") {
+            notifying = true;
+        }
+        else if(arg == "-p" && i + 1 < argc) {
+            table_path = argv[++i];
+        }
+        else if(arg == "-s" && i + 1 < argc) {
+            string policy = argv[++i];
+            if (policy == "async") sync_policy = SYNC_ASYNC;
+            else if (policy == "sync") sync_policy = SYNC_FULL;
+            else sync_policy = SYNC_NONE;
+        }
+    }
+
+    // -m names the highest account id, so a shard starting at -l holds fewer accounts
+    max_accounts = max(1, max_accounts - first_id);
+
+    FinanceServer server;
+    server.first_id = first_id;
+    // Change numbers start from the clock, so a restarted server numbers its changes above
+    // everything its predecessor handed out
+    server.changes = chrono::duration_cast<chrono::microseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    server.table.policy = sync_policy;
+    if (table_path.empty() || !map_account_table(server.table, table_path, max_accounts)) {
+        if (!table_path.empty()) {
+            perror(("Failed to map account table " + table_path + ", using memory only").c_str());
+        }
+        server.table.accounts = new Account[max_accounts];
+        server.table.capacity = max_accounts;
+    }
+    server.max_accounts = server.table.capacity;
+    if (notifying) {
+        // A client that exits must not take this server down with SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+        server.notifying = true;
+        thread(retry_missed_notifies, std::ref(server)).detach();
+    }
+
+    vector<thread> workers;
+    if (!primary_name.empty()) {
+        workers.emplace_back(follow_primary, std::ref(server), primary_name);
+    }
+    if (!replica_name.empty()) {
+        // A standby that exits must not take this server down with SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+        server.replica.reset(new RequestChannel(replica_name, RequestChannel::CLIENT_SIDE));
+        server.replicated = true;
+    }
+
+    // Extra channels are served alongside the primary one
+    for (int i = 1; i < num_channels; i++) {
+        workers.emplace_back(serve, std::ref(server), RequestChannel::channel_name(name, i), false);
+    }
+    serve(server, name, true);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,223 @@
+#include "finance_router.h"
+#include "signals.h"
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <signal.h>
+#include <unistd.h>
+
+using namespace std;
+
+FinanceRouter::FinanceRouter(int _max_account, int num_shards, bool with_standby) : max_account(_max_account) {
+    int num_ids = max(1, max_account + 1);
+    num_shards = max(1, min(num_shards, num_ids));
+    int per_shard = (num_ids + num_shards - 1) / num_shards;
+
+    for (int k = 0; k < num_shards; k++) {
+        Shard shard;
+        shard.name = (num_shards == 1) ? "finance" : "finance" + to_string(k);
+        shard.first_id = k * per_shard;
+        shard.last_id = min(max_account, (k + 1) * per_shard - 1);
+        if (shard.first_id > shard.last_id) {
+            break;
+        }
+        if (with_standby) {
+            shard.standby_name = shard.name + "-standby";
+            shard.replication_name = shard.name + "-repl";
+        } else {
+            shard.notify_name = shard.name + "-notify";
+        }
+        shards.push_back(std::move(shard));
+    }
+}
+
+FinanceRouter::~FinanceRouter() {
+    for (Shard& shard : shards) {
+        if (shard.listener.joinable()) {
+            shard.listener.join();
+        }
+    }
+}
+
+void FinanceRouter::connect() {
+    for (Shard& shard : shards) {
+        shard.channel.reset(new RequestChannel(shard.name, RequestChannel::CLIENT_SIDE));
+        if (!shard.standby_name.empty()) {
+            shard.standby.reset(new RequestChannel(shard.standby_name, RequestChannel::CLIENT_SIDE));
+        }
+        if (!shard.notify_name.empty()) {
+            // The shard pushes changes, so this end is the one that receives requests
+            shard.notify.reset(new RequestChannel(shard.notify_name, RequestChannel::SERVER_SIDE));
+            shard.cache.reset(new BalanceCache());
+            shard.listener = thread(&FinanceRouter::listen, this, std::ref(shard));
+        }
+    }
+    if (shards.size() > 1) {
+        pool.reset(new ThreadPool(shards.size()));
+    }
+}
+
+FinanceRouter::Shard* FinanceRouter::route(int user_id) {
+    if (user_id < 0 || user_id > max_account) {
+        return nullptr;
+    }
+    // Shards are equal-sized ranges, so the owner can be computed directly
+    size_t k = user_id / (shards[0].last_id - shards[0].first_id + 1);
+    return &shards[min(k, shards.size() - 1)];
+}
+
+Response FinanceRouter::send_request(const Request& req, int timeout_seconds) {
+    if (req.type == QUIT) {
+        quitting = true;
+        Response resp = (shards.size() == 1) ? send_to_shard(shards[0], req, timeout_seconds) : broadcast(req, timeout_seconds);
+        // Standbys that never took over still need to be shut down
+        for (Shard& shard : shards) {
+            if (shard.standby && !shard.failed_over) {
+                shard.standby->send_request(req, timeout_seconds);
+            }
+        }
+        return resp;
+    }
+
+    Shard* shard = route(req.user_id);
+    if (!shard) {
+        return Response(false, 0, "", "Invalid account ID");
+    }
+    if (shards.size() > 1 && (req.type == EARN_INTEREST || req.type == AGGREGATE)) {
+        return broadcast(req, timeout_seconds);
+    }
+    double balance;
+    if (req.type == BALANCE && shard->cache && shard->cache->get(req.user_id, balance)) {
+        return Response(true, balance, "", "View balance successful");
+    }
+    return send_to_shard(*shard, req, timeout_seconds);
+}
+
+bool FinanceRouter::cache_stats(uint64_t& hits, uint64_t& misses) const {
+    bool cached = false;
+    hits = misses = 0;
+    for (const Shard& shard : shards) {
+        if (shard.cache) {
+            hits += shard.cache->hits();
+            misses += shard.cache->misses();
+            cached = true;
+        }
+    }
+    return cached;
+}
+
+/*
+*  Applies the changes a shard pushes until it quits. A supervised shard that dies is
+*  restarted on the same channel, so the listener waits for it. Signals are left to the
+*  main thread.
+*/
+void FinanceRouter::listen(Shard& shard) {
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+    Request change(QUIT);
+    while (true) {
+        if (!shard.notify->receive_oneway(change)) {
+            if (!supervised || quitting) {
+                return;
+            }
+            usleep(1000);
+            continue;
+        }
+        uint64_t version = strtoull(change.data.c_str(), nullptr, 10);
+        if (change.type == EARN_INTEREST) {
+            shard.cache->invalidate_all(version);
+        } else if (change.type == BALANCE) {
+            shard.cache->put(change.user_id, change.amount, version);
+        }
+    }
+}
+
+// Caches what a response says about balances; its data is the change number it reflects
+void FinanceRouter::remember(Shard& shard, const Request& req, const Response& resp) {
+    if (!resp.success || resp.data.empty()) {
+        return;
+    }
+    uint64_t version = strtoull(resp.data.c_str(), nullptr, 10);
+    if (req.type == EARN_INTEREST) {
+        shard.cache->invalidate_all(version);
+    } else if (req.type == BALANCE || req.type == DEPOSIT || req.type == WITHDRAW) {
+        shard.cache->put(req.user_id, resp.balance, version);
+    }
+}
+
+void FinanceRouter::fail_over(Shard& shard) {
+    shard.failed_over = true;
+    SignalHandling::log_signal_event("Finance server " + shard.name + " lost, failing over to " + shard.standby_name);
+    cerr << "Finance server " << shard.name << " is down, switched to " << shard.standby_name << endl;
+}
+
+Response FinanceRouter::send_to_shard(Shard& shard, const Request& req, int timeout_seconds) {
+    if (!shard.standby) {
+        Response resp = shard.channel->send_request(req, timeout_seconds);
+        if (shard.cache) {
+            remember(shard, req, resp);
+        }
+        return resp;
+    }
+
+    // The standby sees every mutation before the primary answers, so it can serve reads
+    if (req.type == BALANCE && SignalHandling::is_server_active(shard.standby_name)) {
+        return shard.standby->send_request(req, timeout_seconds);
+    }
+
+    // SIGCHLD marks a dead primary inactive, so most failovers happen before any I/O
+    if (!shard.failed_over && !SignalHandling::is_server_active(shard.name)) {
+        fail_over(shard);
+    }
+    if (shard.failed_over) {
+        return shard.standby->send_request(req, timeout_seconds);
+    }
+
+    Response resp = shard.channel->send_request(req, timeout_seconds);
+    // A broken channel yields a response without any message
+    if (!resp.success && (resp.message.empty() || resp.message == "Write failed" || resp.message == "Read failed")) {
+        fail_over(shard);
+        resp = shard.standby->send_request(req, timeout_seconds);
+    }
+    return resp;
+}
+
+/*
+*  Sends req to every shard at once and gathers the answers. Each shard's request has a
+*  deadline of its own, so a hung shard fails the broadcast rather than holding it up.
+*/
+Response FinanceRouter::broadcast(const Request& req, int timeout_seconds) {
+    vector<Response> responses(shards.size());
+    pool->parallel_reduce(0, shards.size(), 0,
+        [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                // Each shard checks the id against its own range, so address it by one it owns
+                Request shard_req = req;
+                shard_req.user_id = shards[k].first_id;
+                responses[k] = send_to_shard(shards[k], shard_req, timeout_seconds);
+            }
+            return 0;
+        },
+        [](int a, int b) { return a + b; });
+
+    Response merged(true, 0, "", responses[0].message);
+    BankStats stats;
+    for (size_t k = 0; k < shards.size(); k++) {
+        const Response& resp = responses[k];
+        if (!resp.success) {
+            Response failed = resp;
+            failed.message = "Shard " + shards[k].name + " failed: " + (resp.message.empty() ? "no response" : resp.message);
+            return failed;
+        }
+        if (req.type == AGGREGATE) {
+            stats.merge(BankStats::parse(resp.data));
+        }
+    }
+    if (req.type == AGGREGATE) {
+        merged.balance = stats.total_balance;
+        merged.data = stats.serialize();
+    }
+    return merged;
+}
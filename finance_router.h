@@ -0,0 +1,78 @@
+#ifndef _FINANCE_ROUTER_H_
+#define _FINANCE_ROUTER_H_
+
+#include "common.h"
+#include "channel.h"
+#include "thread_pool.h"
+#include "balance_cache.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+*  Client-side view of a finance service split into shards, each a separate finance
+*  process owning a contiguous range of user ids. Point requests go to the owning shard;
+*  EARN_INTEREST, AGGREGATE and QUIT are sent to every shard in parallel and the
+*  responses are merged. With a single shard this is a plain RequestChannel("finance").
+*
+*  A shard may have a hot standby that receives every mutation from its primary. The
+*  standby answers BALANCE reads, and once the primary is reported dead (or its channel
+*  breaks) all of the shard's traffic moves to the standby.
+*
+*  A shard without a standby keeps a BalanceCache, so repeated BALANCE requests are
+*  answered locally. The shard pushes every balance change to it over a notify channel,
+*  so changes made by other clients and interest sweeps reach the cache too. Shards with
+*  a standby are not cached, since a takeover would start over with other change numbers.
+*/
+class FinanceRouter {
+public:
+    struct Shard {
+        std::string name;  // server/channel name, also passed to finance with -n
+        int first_id;
+        int last_id;
+        std::unique_ptr<RequestChannel> channel;
+
+        std::string standby_name;  // empty without a standby
+        std::string replication_name; // channel from primary (-r) to standby (-R)
+        std::unique_ptr<RequestChannel> standby;
+        bool failed_over = false;
+
+        std::string notify_name; // empty if the shard is not cached; finance is given -N
+        std::unique_ptr<RequestChannel> notify;
+        std::unique_ptr<BalanceCache> cache;
+        std::thread listener;
+    };
+
+    FinanceRouter(int max_account, int num_shards, bool with_standby = false);
+    // Waits for the listeners, which stop once the shards have quit
+    ~FinanceRouter();
+
+    // Opens the client side of every shard's channel; the shards must have been started
+    void connect();
+    // Set before connect() when a Supervisor restarts the shards and reopens their channels
+    void set_supervised(bool on) { supervised = on; }
+
+    Response send_request(const Request& req, int timeout_seconds = 30);
+
+    std::vector<Shard>& get_shards() { return shards; }
+    // Totals over the cached shards; false if no shard is cached
+    bool cache_stats(uint64_t& hits, uint64_t& misses) const;
+
+private:
+    int max_account;
+    std::vector<Shard> shards;
+    std::unique_ptr<ThreadPool> pool; // one worker per shard for fan-out requests
+    bool supervised = false;
+    std::atomic<bool> quitting{false};
+
+    Shard* route(int user_id);
+    Response broadcast(const Request& req, int timeout_seconds);
+    Response send_to_shard(Shard& shard, const Request& req, int timeout_seconds);
+    void fail_over(Shard& shard);
+    void listen(Shard& shard);
+    void remember(Shard& shard, const Request& req, const Response& resp);
+};
+
+#endif
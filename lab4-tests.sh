@@ -14,7 +14,7 @@ NC='\033[0m' # No Color
 
 # Test result tracking
 TOTAL_POINTS=0
-MAX_POINTS=100
+MAX_POINTS=140
 
 award_points() {
     local test_name=$1
@@ -130,6 +130,145 @@ else
 fi
 
 
+timeout 60s bash -c '
+{
+    echo "10"
+    echo "test.log"
+    echo "1"
+    echo ".txt"
+    echo "1"
+    echo "1"
+    echo "2"
+    echo "100"
+    echo "7"
+    echo "1"
+    echo "2"
+    echo "2"
+    echo "50"
+    echo "10"
+    echo "0"
+} | ./client > tmp/test5 2>&1'
+
+# Check the result
+if [ $? -eq 124 ]; then
+    award_points "Bank statistics" 0 5 "The command timed out after 60 seconds."
+elif grep -q "Active accounts: 2" "tmp/test5" && \
+    grep -q "Total deposits: 150" "tmp/test5" && \
+    grep -q "\[10, 100): 1" "tmp/test5" && \
+    grep -q "\[100, 1000): 1" "tmp/test5"; then
+    award_points "Bank statistics" 5 5 "Successfully computed statistics"
+else
+    award_points "Bank statistics" 0 5 "Failed statistics"
+fi
+
+
+rm -f audit_test.log audit_test.log.idx
+timeout 60s bash -c '
+{
+    echo "10"
+    echo "audit_test.log"
+    echo "1"
+    echo ".txt"
+    echo "1"
+    echo "3"
+    echo "2"
+    echo "25"
+    echo "7"
+    echo "1"
+    echo "4"
+    echo "2"
+    echo "40"
+    echo "7"
+    echo "1"
+    echo "3"
+    echo "11"
+    echo "0"
+    echo "0"
+} | ./client > tmp/test6 2>&1'
+
+# Only user 3's records come back, in the order they were logged
+if [ $? -eq 124 ]; then
+    award_points "Audit history" 0 5 "The command timed out after 60 seconds."
+elif grep -q "Audit History (4 record(s))" "tmp/test6" && \
+    grep -A4 "Audit History (" "tmp/test6" | tail -1 | grep -q "\[3\]: logged in" && \
+    ! grep -A4 "Audit History (" "tmp/test6" | grep -q "\[4\]"; then
+    award_points "Audit history" 5 5 "Successfully queried audit history"
+else
+    award_points "Audit history" 0 5 "Failed audit history"
+fi
+rm -f audit_test.log audit_test.log.idx
+
+
+rm -f script_test.log script_test.log.idx
+cat > tmp/script7 <<'EOF'
+accounts 10
+log script_test.log
+login 2
+deposit 80
+withdraw 500   # fails, and the script carries on
+withdraw 30
+balance
+logout
+EOF
+timeout 60s ./client -b tmp/script7 > tmp/test7 2>&1
+
+# Every operation gets a latency line, and the totals count the failure
+if [ $? -eq 124 ]; then
+    award_points "Scripted client" 0 5 "The command timed out after 60 seconds."
+elif grep -q "^7: balance: ok in [0-9]* us (balance 50)" "tmp/test7" && \
+    grep -q "^5: withdraw 500: failed" "tmp/test7" && \
+    grep -q "^withdraw: 2 ops, 1 failed" "tmp/test7" && \
+    grep -q "^6 operations, 1 failed" "tmp/test7" && \
+    ! grep -q "Banking System Menu" "tmp/test7"; then
+    award_points "Scripted client" 5 5 "Successfully ran the script"
+else
+    award_points "Scripted client" 0 5 "Failed scripted client"
+fi
+rm -f script_test.log script_test.log.idx
+
+
+rm -f config_test.log config_test.log.idx
+cat > tmp/config8 <<'EOF'
+accounts 10   # no prompts: the menu comes up as soon as the servers are ready
+log config_test.log
+extensions .txt
+EOF
+timeout 60s bash -c 'echo -e "1\n4\n2\n40\n4\n0\n" | ./client -f tmp/config8 > tmp/test8 2>&1'
+
+if [ $? -eq 124 ]; then
+    award_points "Config-file startup" 0 5 "The command timed out after 60 seconds."
+elif grep -q "Servers ready in [0-9.]* ms" "tmp/test8" && \
+    grep -q "Current balance: 40" "tmp/test8" && \
+    ! grep -q "Enter the maximum account number" "tmp/test8"; then
+    award_points "Config-file startup" 5 5 "Successfully started from a config file"
+else
+    award_points "Config-file startup" 0 5 "Failed config-file startup"
+fi
+rm -f config_test.log config_test.log.idx
+
+
+rm -f restart_test.log restart_test.log.idx
+cat > tmp/config9 <<'EOF'
+accounts 10
+log restart_test.log
+extensions .txt
+supervise yes
+EOF
+# The finance server is killed between the deposit and the balance view
+timeout 60s bash -c '{ echo -e "1\n6\n2\n70"; sleep 0.5; pkill -9 -x finance; sleep 0.5; echo -e "4\n8\n0"; } |
+    ./client -f tmp/config9 > tmp/test9 2>&1'
+
+if [ $? -eq 124 ]; then
+    award_points "Server restart" 0 5 "The command timed out after 60 seconds."
+elif grep -q "Server finance recovered in [0-9.]* ms" "tmp/test9" && \
+    grep -q "Current balance: 70" "tmp/test9" && \
+    grep -q "finance: restarted 1 time(s)" "tmp/test9"; then
+    award_points "Server restart" 5 5 "Restarted finance with its balances"
+else
+    award_points "Server restart" 0 5 "Failed server restart"
+fi
+rm -f restart_test.log restart_test.log.idx
+
 
 ###
 #formerly private tests
@@ -155,6 +294,25 @@ else
     else
         award_points "ThreadPool Enqueue" 0 15 "Failed"
     fi
+    if grep -q "TEST: ThreadPool parallel_reduce - PASSED ✓" "unit_test_results.txt"; then
+        award_points "ThreadPool parallel_reduce" 5 5 "Passed"
+    else
+        award_points "ThreadPool parallel_reduce" 0 5 "Failed"
+    fi
+    if grep -q "TEST: ThreadPool submit - PASSED ✓" "unit_test_results.txt"; then
+        award_points "ThreadPool submit" 5 5 "Passed"
+    else
+        award_points "ThreadPool submit" 0 5 "Failed"
+    fi
+fi
+
+timeout 60s bash -c ./logwritertest >> unit_test_results.txt
+if [ $? -eq 124 ]; then
+    award_points "LogWriter tests" 0 5 "The command timed out after 60 seconds."
+elif grep -q "TEST: LogWriter rotation under load - PASSED ✓" "unit_test_results.txt"; then
+    award_points "LogWriter rotation under load" 5 5 "Passed"
+else
+    award_points "LogWriter rotation under load" 0 5 "Failed"
 fi
 
 
@@ -0,0 +1,281 @@
+#include "common.h"
+#include "channel.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/*
+*  Load generator: starts a finance and a file server with one channel per simulated
+*  user, runs the users concurrently through a weighted mix of operations, and reports
+*  throughput and latency percentiles per operation as text and, with -j, as JSON.
+*
+*    ./loadgen [-u users] [-n ops per user | -d seconds] [-a accounts] [-s file bytes]
+*              [-m deposit=40,withdraw=20,balance=30,file=8,interest=2] [-t timeout] [-j report.json]
+*
+*  A file operation uploads one of the user's files or downloads one it has uploaded.
+*  Accounts are picked at random, so users contend for them as real clients would.
+*  "failed" counts requests the servers turned down, such as withdrawals from accounts
+*  without the funds, and also those given up on after the request timeout (-t seconds,
+*  default 30), which are counted again under "timeouts". Each request's timeout is
+*  kept by its own channel, so the users never share a timer. The servers run in the
+*  current directory, like the client's.
+*/
+
+static const int MAX_USERS = 64;
+
+enum Operation {OP_DEPOSIT, OP_WITHDRAW, OP_BALANCE, OP_UPLOAD, OP_DOWNLOAD, OP_INTEREST, NUM_OPERATIONS};
+static const char* OPERATION_NAMES[NUM_OPERATIONS] = {"deposit", "withdraw", "balance", "upload", "download",
+                                                      "interest"};
+
+struct Options {
+    int users = 8;
+    long ops_per_user = 1000;
+    double seconds = 0; // when set, run for this long instead of a number of operations
+    int accounts = 1000;
+    size_t file_bytes = 4096;
+    int timeout_seconds = 30;
+    string json_path;
+    // Weights of deposit, withdraw, balance, file and interest operations
+    map<string, int> mix = {{"deposit", 40}, {"withdraw", 20}, {"balance", 30}, {"file", 8}, {"interest", 2}};
+};
+
+// One user's latencies, in microseconds, per operation
+struct UserResults {
+    vector<double> latencies[NUM_OPERATIONS];
+    long failures[NUM_OPERATIONS] = {};
+    long timeouts[NUM_OPERATIONS] = {};
+};
+
+static bool parse_mix(const string& spec, map<string, int>& mix) {
+    map<string, int> parsed;
+    stringstream entries(spec);
+    string entry;
+    while (getline(entries, entry, ',')) {
+        size_t eq = entry.find('=');
+        string name = entry.substr(0, eq);
+        if (eq == string::npos || mix.find(name) == mix.end()) {
+            return false;
+        }
+        parsed[name] = max(0, atoi(entry.c_str() + eq + 1));
+    }
+    for (auto& weight : mix) {
+        weight.second = parsed.count(weight.first) ? parsed[weight.first] : 0;
+    }
+    return true;
+}
+
+static pid_t spawn(const vector<string>& args) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        vector<char*> argv;
+        for (const string& arg : args) {
+            argv.push_back((char*)arg.c_str());
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        perror(("exec " + args[0]).c_str());
+        _exit(1);
+    }
+    return pid;
+}
+
+/*
+*  One simulated user: picks each operation by weight and times its round trip. Files
+*  are named after the user, so downloads only ask for what this user uploaded.
+*/
+static void run_user(int id, const Options& options, RequestChannel& finance, RequestChannel& file,
+                     chrono::steady_clock::time_point deadline, UserResults& results) {
+    mt19937 rng(id * 7919 + 1);
+    const map<string, int>& mix = options.mix;
+    vector<int> weights = {mix.at("deposit"), mix.at("withdraw"), mix.at("balance"), mix.at("file"),
+                           mix.at("interest")};
+    discrete_distribution<int> pick(weights.begin(), weights.end());
+    uniform_int_distribution<int> account(1, options.accounts);
+    string contents(options.file_bytes, 'a' + id % 26);
+    int uploaded = 0;
+
+    for (long n = 0; options.seconds > 0 ? chrono::steady_clock::now() < deadline : n < options.ops_per_user; n++) {
+        int choice = pick(rng);
+        Operation op;
+        Request req(BALANCE);
+        RequestChannel* channel = &finance;
+        if (choice == 0 || choice == 1) {
+            op = choice == 0 ? OP_DEPOSIT : OP_WITHDRAW;
+            req = Request(choice == 0 ? DEPOSIT : WITHDRAW, account(rng), 1 + rng() % 100);
+        } else if (choice == 2) {
+            op = OP_BALANCE;
+            req = Request(BALANCE, account(rng));
+        } else if (choice == 3) {
+            // Upload until the user has a few files, then mostly download them
+            channel = &file;
+            if (uploaded == 0 || (uploaded < 16 && rng() % 2 == 0)) {
+                op = OP_UPLOAD;
+                memcpy(&contents[0], &n, min(sizeof(n), contents.size()));
+                req = Request(UPLOAD_FILE, id, 0, "load_" + to_string(id) + "_" + to_string(uploaded++) + ".txt",
+                              contents);
+            } else {
+                op = OP_DOWNLOAD;
+                req = Request(DOWNLOAD_FILE, id, 0,
+                              "load_" + to_string(id) + "_" + to_string(rng() % uploaded) + ".txt");
+            }
+        } else {
+            op = OP_INTEREST;
+            req = Request(EARN_INTEREST, 0, 2);
+        }
+
+        auto start = chrono::steady_clock::now();
+        Response resp = channel->send_request(req, options.timeout_seconds);
+        results.latencies[op].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        results.failures[op] += !resp.success;
+        results.timeouts[op] += resp.timed_out;
+    }
+}
+
+static double percentile(const vector<double>& sorted, double p) {
+    return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-u" && i + 1 < argc) {
+            options.users = max(1, min(MAX_USERS, atoi(argv[++i])));
+        } else if (arg == "-n" && i + 1 < argc) {
+            options.ops_per_user = max(1L, atol(argv[++i]));
+        } else if (arg == "-d" && i + 1 < argc) {
+            options.seconds = atof(argv[++i]);
+        } else if (arg == "-a" && i + 1 < argc) {
+            options.accounts = max(1, atoi(argv[++i]));
+        } else if (arg == "-s" && i + 1 < argc) {
+            options.file_bytes = max(1L, atol(argv[++i]));
+        } else if (arg == "-t" && i + 1 < argc) {
+            options.timeout_seconds = max(1, atoi(argv[++i]));
+        } else if (arg == "-j" && i + 1 < argc) {
+            options.json_path = argv[++i];
+        } else if (arg == "-m" && i + 1 < argc && parse_mix(argv[i + 1], options.mix)) {
+            i++;
+        } else {
+            cerr << "Usage: " << argv[0] << " [-u users] [-n ops per user | -d seconds] [-a accounts]"
+                 << " [-s file bytes] [-m deposit=40,withdraw=20,balance=30,file=8,interest=2] [-t timeout]"
+                 << " [-j report.json]"
+                 << endl;
+            return 1;
+        }
+    }
+
+    // Servers with one channel per user, so users only queue behind each other inside them
+    string channels = to_string(options.users);
+    vector<pid_t> servers = {spawn({"./finance", "-m", to_string(options.accounts), "-c", channels}),
+                             spawn({"./file", "-C", "64", "-c", channels})};
+
+    // Opening a channel waits for the server's side, so open them all at once
+    vector<unique_ptr<RequestChannel>> finance(options.users), file(options.users);
+    vector<thread> threads;
+    for (int i = 0; i < options.users; i++) {
+        threads.emplace_back([&, i] {
+            finance[i].reset(new RequestChannel(RequestChannel::channel_name("finance", i), RequestChannel::CLIENT_SIDE));
+            file[i].reset(new RequestChannel(RequestChannel::channel_name("file", i), RequestChannel::CLIENT_SIDE));
+        });
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    threads.clear();
+
+    cout << "Running " << options.users << " users, ";
+    if (options.seconds > 0) {
+        cout << "for " << options.seconds << " s";
+    } else {
+        cout << options.ops_per_user << " operations each";
+    }
+    cout << endl;
+
+    vector<UserResults> results(options.users);
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::microseconds((long long)(options.seconds * 1e6));
+    for (int i = 0; i < options.users; i++) {
+        threads.emplace_back(run_user, i, std::cref(options), std::ref(*finance[i]), std::ref(*file[i]), deadline,
+                             std::ref(results[i]));
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    finance[0]->send_request(Request(QUIT), options.timeout_seconds);
+    file[0]->send_request(Request(QUIT), options.timeout_seconds);
+    for (pid_t pid : servers) {
+        waitpid(pid, nullptr, 0);
+    }
+
+    // Merge the users' results and report
+    char line[160];
+    snprintf(line, sizeof(line), "%-10s %9s %8s %8s %10s %10s %10s %10s %10s", "operation", "count", "failed",
+             "timeouts", "ops/sec", "mean us", "p50 us", "p99 us", "p999 us");
+    cout << line << endl;
+    ostringstream json;
+    json << "{\n  \"users\": " << options.users << ",\n  \"seconds\": " << seconds << ",\n  \"operations\": {";
+    long total = 0, total_failures = 0, total_timeouts = 0;
+    bool first = true;
+    for (int op = 0; op < NUM_OPERATIONS; op++) {
+        vector<double> latencies;
+        long failures = 0, timeouts = 0;
+        for (const UserResults& user : results) {
+            latencies.insert(latencies.end(), user.latencies[op].begin(), user.latencies[op].end());
+            failures += user.failures[op];
+            timeouts += user.timeouts[op];
+        }
+        if (latencies.empty()) {
+            continue;
+        }
+        sort(latencies.begin(), latencies.end());
+        double mean = 0;
+        for (double us : latencies) {
+            mean += us / latencies.size();
+        }
+        double p50 = percentile(latencies, 0.5), p99 = percentile(latencies, 0.99);
+        double p999 = percentile(latencies, 0.999);
+        total += latencies.size();
+        total_failures += failures;
+        total_timeouts += timeouts;
+
+        snprintf(line, sizeof(line), "%-10s %9zu %8ld %8ld %10.0f %10.1f %10.1f %10.1f %10.1f", OPERATION_NAMES[op],
+                 latencies.size(), failures, timeouts, latencies.size() / seconds, mean, p50, p99, p999);
+        cout << line << endl;
+        json << (first ? "" : ",") << "\n    \"" << OPERATION_NAMES[op] << "\": {\"count\": " << latencies.size()
+             << ", \"failures\": " << failures << ", \"timeouts\": " << timeouts
+             << ", \"ops_per_sec\": " << latencies.size() / seconds
+             << ", \"mean_us\": " << mean << ", \"p50_us\": " << p50 << ", \"p99_us\": " << p99
+             << ", \"p999_us\": " << p999 << ", \"max_us\": " << latencies.back() << "}";
+        first = false;
+    }
+    snprintf(line, sizeof(line), "%-10s %9ld %8ld %8ld %10.0f", "total", total, total_failures, total_timeouts,
+             total / seconds);
+    cout << line << endl;
+    json << "\n  },\n  \"total\": {\"count\": " << total << ", \"failures\": " << total_failures
+         << ", \"timeouts\": " << total_timeouts << ", \"ops_per_sec\": " << total / seconds << "}\n}\n";
+
+    if (!options.json_path.empty()) {
+        ofstream out(options.json_path);
+        if (!(out << json.str())) {
+            cerr << "Could not write " << options.json_path << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,342 @@
+#include "log_writer.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// Compresses segment into segment.gz; the .gz only appears once it is complete
+static void gzip_segment(const string& segment) {
+    string tmp = segment + ".gz.tmp";
+    FILE* in = fopen(segment.c_str(), "rb");
+    gzFile out = gzopen(tmp.c_str(), "wb6");
+    if (!in || !out) {
+        perror(("Failed to compress " + segment).c_str());
+        if (in) fclose(in);
+        if (out) gzclose(out);
+        return;
+    }
+
+    char buf[1 << 16];
+    size_t n;
+    bool ok = true;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        ok = gzwrite(out, buf, n) == (int)n;
+    }
+    fclose(in);
+    ok = (gzclose(out) == Z_OK) && ok;
+
+    if (ok && rename(tmp.c_str(), (segment + ".gz").c_str()) == 0) {
+        unlink(segment.c_str());
+    } else {
+        perror(("Failed to compress " + segment).c_str());
+        unlink(tmp.c_str());
+    }
+}
+
+string LogWriter::segment_name(const string& path, unsigned seq) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%06u", seq);
+    return path + suffix;
+}
+
+LogWriter::LogWriter(const string& _path, const Options& _options) :
+    path(_path), options(_options), fd(-1), opened(false), file_bytes(0), next_segment(1),
+    ring(max(_options.ring_bytes, _options.batch_bytes)), head(0), size(0), appended(0),
+    pending_records(0), stop(false), front_written(0), front_offset(0),
+    written_records(0), written_batches(0), rotated_segments(0) {
+
+    // Continue numbering after the newest existing segment, and finish compressing
+    // any segment an earlier run closed but did not get to compress
+    size_t slash = path.find_last_of('/');
+    string dir = (slash == string::npos) ? "." : path.substr(0, slash);
+    string base = (slash == string::npos) ? path : path.substr(slash + 1);
+    vector<string> uncompressed;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (struct dirent* entry = readdir(d)) {
+            // Segments are <base>.NNNNNN or <base>.NNNNNN.gz
+            string name = entry->d_name;
+            if (name.compare(0, base.size() + 1, base + ".") != 0) {
+                continue;
+            }
+            string rest = name.substr(base.size() + 1);
+            if (rest.size() < 6 || rest.find_first_not_of("0123456789") < 6) {
+                continue;
+            }
+            string suffix = rest.substr(6);
+            if (!suffix.empty() && suffix != ".gz") {
+                continue;
+            }
+            unsigned seq = strtoul(rest.substr(0, 6).c_str(), nullptr, 10);
+            next_segment = max(next_segment, seq + 1);
+            if (suffix.empty()) {
+                uncompressed.push_back(segment_name(path, seq));
+            }
+        }
+        closedir(d);
+    }
+
+    if (options.compress) {
+        compressor.reset(new ThreadPool(1));
+        for (const string& segment : uncompressed) {
+            compress_later(segment);
+        }
+    }
+
+    if (!open_live_file()) {
+        return;
+    }
+    opened = true;
+    writer = thread(&LogWriter::run, this);
+}
+
+LogWriter::~LogWriter() {
+    close();
+}
+
+void LogWriter::close() {
+    {
+        lock_guard<mutex> lock(ringMutex);
+        stop = true;
+    }
+    dataReady.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    {
+        // Everything appended has been written; later appends are dropped
+        lock_guard<mutex> lock(ringMutex);
+        opened = false;
+    }
+    spaceReady.notify_all();
+    // Destroying the pool finishes the queued compressions
+    compressor.reset();
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// Replaces fd with the live file; fd is left alone if it cannot be opened
+bool LogWriter::open_live_file() {
+    int live = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (live < 0) {
+        perror(("Error opening log file " + path).c_str());
+        return false;
+    }
+    fd = live;
+    struct stat st;
+    file_bytes = (fstat(fd, &st) == 0) ? st.st_size : 0;
+    file_opened = chrono::steady_clock::now();
+
+    if (file_bytes == 0 && !options.file_header.empty()) {
+        struct iovec iov = {(void*)options.file_header.data(), options.file_header.size()};
+        write_all(&iov, 1);
+        file_bytes = options.file_header.size();
+    }
+    return true;
+}
+
+/*
+*  Runs on the writer thread between batches, so records never straddle two files. The
+*  next live file is open before the old one is closed, so there is always one to write
+*  to; if it cannot be opened, the old file stays live.
+*/
+void LogWriter::rotate() {
+    string segment = segment_name(path, next_segment);
+    if (options.durability == FSYNC) {
+        fsync(fd);
+    }
+    if (rename(path.c_str(), segment.c_str()) < 0) {
+        perror(("Failed to rotate " + path).c_str());
+        return;
+    }
+    int old_fd = fd;
+    if (!open_live_file()) {
+        rename(segment.c_str(), path.c_str());
+        return;
+    }
+    ::close(old_fd);
+    next_segment++;
+    rotated_segments++;
+    compress_later(segment);
+}
+
+void LogWriter::compress_later(const string& segment) {
+    if (compressor) {
+        compressor->enqueue([segment] { gzip_segment(segment); });
+    }
+}
+
+void LogWriter::append(const string& record, const RecordKey* key) {
+    if (!opened) {
+        return;
+    }
+
+    unique_lock<mutex> lock(ringMutex);
+    if (options.on_written) {
+        PendingRecord meta = {record.size(), key != nullptr, key ? *key : RecordKey()};
+        pending.push_back(meta);
+    }
+    // A record larger than the whole ring is written out in pieces as room frees up
+    size_t offset = 0;
+    while (offset < record.size()) {
+        spaceReady.wait(lock, [this] { return size < ring.size(); });
+
+        size_t tail = (head + size) % ring.size();
+        size_t room = min(ring.size() - size, ring.size() - tail);
+        size_t n = min(room, record.size() - offset);
+        copy(record.data() + offset, record.data() + offset + n, ring.begin() + tail);
+        size += n;
+        offset += n;
+
+        if (offset < record.size()) {
+            dataReady.notify_one(); // the ring is full; let the writer make room
+        }
+    }
+    appended++;
+    pending_records++;
+
+    if (size >= options.batch_bytes) {
+        dataReady.notify_one();
+    }
+}
+
+void LogWriter::flush() {
+    unique_lock<mutex> lock(ringMutex);
+    uint64_t target = appended;
+    dataReady.notify_one();
+    spaceReady.wait(lock, [this, target] { return written_records.load() >= target || !opened; });
+}
+
+void LogWriter::run() {
+    unique_lock<mutex> lock(ringMutex);
+    while (true) {
+        // Wait for a full batch, but never sit on buffered records past the interval
+        dataReady.wait_for(lock, chrono::milliseconds(options.flush_interval_ms), [this] {
+            return stop || size >= options.batch_bytes || written_records.load() < appended;
+        });
+        if (size == 0) {
+            if (stop) {
+                return;
+            }
+            continue;
+        }
+
+        size_t start = head;
+        size_t len = size;
+        uint64_t batch_records = pending_records;
+        pending_records = 0;
+
+        // Records that end inside this batch; the first may have started in an earlier one
+        vector<PendingRecord> finished;
+        size_t continued = front_written;
+        for (size_t left = len; left > 0 && !pending.empty(); ) {
+            size_t rest = pending.front().length - front_written;
+            if (rest > left) {
+                front_written += left;
+                break;
+            }
+            left -= rest;
+            finished.push_back(pending.front());
+            pending.pop_front();
+            front_written = 0;
+        }
+
+        // Producers may keep appending behind the batch while it is being written
+        lock.unlock();
+        bool too_big = options.rotate_bytes > 0 && file_bytes + len > options.rotate_bytes;
+        bool too_old = options.rotate_interval_s > 0 &&
+            chrono::steady_clock::now() - file_opened >= chrono::seconds(options.rotate_interval_s);
+        // Only rotate on a record boundary
+        if ((too_big || too_old) && file_bytes > options.file_header.size() && continued == 0) {
+            rotate();
+        }
+        uint64_t base = file_bytes;
+        write_batch(start, len);
+        if (options.on_written) {
+            report_locations(finished, continued, base);
+        }
+        lock.lock();
+
+        head = (head + len) % ring.size();
+        size -= len;
+        written_records += batch_records;
+        written_batches++;
+        spaceReady.notify_all();
+    }
+}
+
+void LogWriter::report_locations(const vector<PendingRecord>& finished, size_t continued, uint64_t base) {
+    vector<RecordLocation> locations;
+    uint64_t pos = base;
+    for (size_t i = 0; i < finished.size(); i++) {
+        uint64_t offset = pos;
+        if (i == 0 && continued > 0) {
+            offset = front_offset;
+            pos += finished[i].length - continued;
+        } else {
+            pos += finished[i].length;
+        }
+        if (finished[i].indexed) {
+            RecordLocation loc = {finished[i].key, next_segment, offset, (uint32_t)finished[i].length};
+            locations.push_back(loc);
+        }
+    }
+    // A record that continues into the next batch starts here, unless it started even earlier
+    if (front_written > 0 && !(finished.empty() && continued > 0)) {
+        front_offset = pos;
+    }
+    if (!locations.empty()) {
+        options.on_written(locations);
+    }
+}
+
+void LogWriter::write_batch(size_t start, size_t len) {
+    // The batch may wrap around the end of the ring
+    struct iovec iov[2];
+    int iovcnt = 1;
+    iov[0].iov_base = &ring[start];
+    iov[0].iov_len = min(len, ring.size() - start);
+    if (iov[0].iov_len < len) {
+        iov[1].iov_base = &ring[0];
+        iov[1].iov_len = len - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    if (write_all(iov, iovcnt)) {
+        file_bytes += len;
+    }
+    if (options.durability == FSYNC && fsync(fd) < 0) {
+        perror("Log fsync failed");
+    }
+}
+
+bool LogWriter::write_all(struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Log write failed");
+            return false;
+        }
+        // Skip past whatever a short write managed to store
+        while (iovcnt > 0 && (size_t)n >= iov[0].iov_len) {
+            n -= iov[0].iov_len;
+            iov[0] = iov[1];
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov[0].iov_base = static_cast<char*>(iov[0].iov_base) + n;
+            iov[0].iov_len -= n;
+        }
+    }
+    return true;
+}
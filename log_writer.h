@@ -0,0 +1,133 @@
+#ifndef _LOG_WRITER_H_
+#define _LOG_WRITER_H_
+
+#include "thread_pool.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <cstdint>
+
+/*
+*  Appends records to a log file from a background thread. append() only copies the
+*  record into an in-memory ring; the writer thread drains the ring with one write
+*  per batch once batch_bytes have accumulated or flush_interval_ms has passed.
+*  append() blocks only when the ring is full.
+*
+*  The log can rotate by size or age: the live file <path> is renamed to the next
+*  segment <path>.NNNNNN and a fresh file is started. Closed segments are gzipped to
+*  <path>.NNNNNN.gz on a separate thread, so neither the writer nor the request path
+*  waits for compression.
+*
+*  Records appended with a key are reported to Options::on_written, batch by batch and
+*  after they have been written, together with the segment and offset they landed at.
+*  That is what the audit index is built from.
+*/
+class LogWriter {
+public:
+    enum Durability {
+        BUFFERED, // batches go to the page cache; the kernel decides when they reach disk
+        FSYNC     // every batch is followed by fsync
+    };
+
+    // What an indexed record is looked up by
+    struct RecordKey {
+        int32_t user_id;
+        int64_t timestamp_us;
+    };
+
+    // Where an indexed record was written; the live file is the segment it will become
+    struct RecordLocation {
+        RecordKey key;
+        unsigned segment;
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    struct Options {
+        Durability durability;
+        size_t batch_bytes;
+        int flush_interval_ms;
+        size_t ring_bytes;
+        uint64_t rotate_bytes;   // rotate once the live file would exceed this; 0 = never
+        int rotate_interval_s;   // rotate files older than this; 0 = never
+        bool compress;           // gzip closed segments
+        std::string file_header; // written at the start of every new file
+        std::function<void(const std::vector<RecordLocation>&)> on_written; // runs on the writer thread
+
+        Options() : durability(BUFFERED), batch_bytes(64 * 1024), flush_interval_ms(50),
+                    ring_bytes(4 * 1024 * 1024), rotate_bytes(0), rotate_interval_s(0),
+                    compress(true) {}
+    };
+
+    LogWriter(const std::string& path, const Options& options = Options());
+    ~LogWriter(); // same as close()
+
+    bool is_open() const { return opened; }
+    void append(const std::string& record, const RecordKey* key = nullptr);
+    // Waits until every record appended before the call has been written out
+    void flush();
+    // Writes everything out and waits for pending compression
+    void close();
+
+    uint64_t records_written() const { return written_records.load(); }
+    uint64_t batches_written() const { return written_batches.load(); }
+    uint64_t segments_rotated() const { return rotated_segments.load(); }
+
+    // Name of closed segment number seq, before and after compression
+    static std::string segment_name(const std::string& path, unsigned seq);
+
+private:
+    std::string path;
+    Options options;
+    int fd;              // the live file; only the writer thread changes it
+    // Set by the constructor once the log is open and cleared by close(); append() drops
+    // records while it is clear
+    std::atomic<bool> opened;
+    uint64_t file_bytes; // size of the live file
+    std::chrono::steady_clock::time_point file_opened;
+    unsigned next_segment;
+
+    std::vector<char> ring;
+    size_t head;     // next byte the writer will drain
+    size_t size;     // bytes waiting in the ring
+    uint64_t appended;  // records appended in total
+    size_t pending_records; // records currently in the ring
+    bool stop;
+
+    // Lengths of the records in the ring, kept only when on_written is set
+    struct PendingRecord {
+        size_t length;
+        bool indexed;
+        RecordKey key;
+    };
+    std::deque<PendingRecord> pending;
+    size_t front_written;  // bytes of pending.front() already written by earlier batches
+    uint64_t front_offset; // where pending.front() starts, once front_written > 0
+
+    std::mutex ringMutex;
+    std::condition_variable dataReady;  // writer waits for a batch
+    std::condition_variable spaceReady; // producers wait for room, flush() for progress
+    std::thread writer;
+    std::unique_ptr<ThreadPool> compressor;
+
+    std::atomic<uint64_t> written_records;
+    std::atomic<uint64_t> written_batches;
+    std::atomic<uint64_t> rotated_segments;
+
+    bool open_live_file();
+    void rotate();
+    void compress_later(const std::string& segment);
+    void run();
+    void write_batch(size_t start, size_t len);
+    void report_locations(const std::vector<PendingRecord>& finished, size_t continued, uint64_t base);
+    bool write_all(struct iovec* iov, int iovcnt);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include "log_writer.h"
+
+// Helper function to print test results
+void print_test_result(const std::string& test_name, bool success) {
+    std::cout << "TEST: " << test_name << " - ";
+
+    if (success) {
+        std::cout << "PASSED ✓" << std::endl;
+    } else {
+        std::cout << "FAILED ✗" << std::endl;
+    }
+}
+
+// Lines in the live file and every segment before it; the files are removed afterwards
+static size_t count_and_remove(const std::string& path, unsigned segments) {
+    size_t lines = 0;
+    for (unsigned seq = 1; seq <= segments + 1; seq++) {
+        std::string name = seq <= segments ? LogWriter::segment_name(path, seq) : path;
+        std::ifstream in(name);
+        std::string line;
+        while (std::getline(in, line)) {
+            lines++;
+        }
+        std::remove(name.c_str());
+    }
+    return lines;
+}
+
+// Records appended from several threads while the log rotates after nearly every batch
+void test_rotation_under_load() {
+    std::cout << "\n======== Testing LogWriter rotation under load ========" << std::endl;
+
+    const std::string path = "test_rotation.log";
+    const int num_threads = 4;
+    const int per_thread = 50000;
+    count_and_remove(path, 0);
+
+    LogWriter::Options options;
+    options.rotate_bytes = 64;
+    options.batch_bytes = 256;
+    options.compress = false;
+    uint64_t written = 0, segments = 0;
+    {
+        LogWriter writer(path, options);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&writer, t, per_thread] {
+                for (int i = 0; i < per_thread; i++) {
+                    writer.append("thread " + std::to_string(t) + " record " + std::to_string(i) + "\n");
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        writer.flush();
+        written = writer.records_written();
+        segments = writer.segments_rotated();
+        writer.close();
+    }
+
+    size_t expected = (size_t)num_threads * per_thread;
+    size_t lines = count_and_remove(path, segments);
+    std::cout << "Appended " << expected << " records, " << written << " written, " << lines
+              << " lines on disk across " << segments + 1 << " files" << std::endl;
+    print_test_result("LogWriter rotation under load", written == expected && lines == expected && segments > 0);
+}
+
+int main() {
+    std::cout << "===== LogWriter Tests =====" << std::endl;
+
+    test_rotation_under_load();
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "audit_record.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+
+using namespace std;
+
+// Decodes a binary audit log (logging -F binary) back to text, optionally filtered
+
+static void usage() {
+    cerr << "Usage: logdecode [-u user_id] [-t type] [-s from_us] [-e to_us] <binary log>" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool filter_user = false, filter_type = false;
+    int user_id = 0, type = 0;
+    int64_t from_us = 0, to_us = LLONG_MAX;
+    string path;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-u" && i + 1 < argc) {
+            filter_user = true;
+            user_id = atoi(argv[++i]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            filter_type = true;
+            type = atoi(argv[++i]);
+        } else if (arg == "-s" && i + 1 < argc) {
+            from_us = atoll(argv[++i]);
+        } else if (arg == "-e" && i + 1 < argc) {
+            to_us = atoll(argv[++i]);
+        } else {
+            path = arg;
+        }
+    }
+    if (path.empty()) {
+        usage();
+        return 1;
+    }
+
+    ifstream in(path, ios::binary);
+    if (!in) {
+        cerr << "Could not open " << path << endl;
+        return 1;
+    }
+
+    char magic[sizeof(AUDIT_LOG_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, AUDIT_LOG_MAGIC, sizeof(magic)) != 0) {
+        cerr << path << " is not a binary audit log" << endl;
+        return 1;
+    }
+
+    // Decode in large chunks; a record split across chunks is carried over
+    vector<char> buf(1 << 20);
+    size_t have = 0;
+    while (true) {
+        in.read(buf.data() + have, buf.size() - have);
+        size_t got = in.gcount();
+        if (got == 0) {
+            break;
+        }
+        have += got;
+
+        size_t pos = 0;
+        AuditRecord rec;
+        while (size_t used = AuditRecord::decode(buf.data() + pos, have - pos, rec)) {
+            pos += used;
+            if ((filter_user && rec.user_id != user_id) || (filter_type && rec.type != type) ||
+                rec.timestamp_us < from_us || rec.timestamp_us > to_us) {
+                continue;
+            }
+            cout << rec.to_text() << '\n';
+        }
+        memmove(buf.data(), buf.data() + pos, have - pos);
+        have -= pos;
+    }
+
+    if (have > 0) {
+        cerr << "Warning: " << have << " trailing bytes do not form a complete record" << endl;
+    }
+    return 0;
+}
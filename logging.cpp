@@ -1,12 +1,36 @@
 #include "common.h"
 #include "channel.h"
+#include "log_writer.h"
+#include "audit_record.h"
+#include "audit_index.h"
+#include <sstream>
+#include <iostream>
 #include <fstream>
+#include <cstring>
 
 using namespace std;
 
+/*
+* Whether an existing log file was written in the chosen format. A missing or empty
+* file matches either; otherwise a binary log must start with the magic and a text
+* log must not, so appending never mixes the two in one file.
+*/
+static bool log_format_matches(const string& path, bool binary) {
+    ifstream in(path, ios::binary);
+    char magic[sizeof(AUDIT_LOG_MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (in.gcount() == 0) {
+        return true;
+    }
+    bool is_binary = in.gcount() == (streamsize)sizeof(magic) && memcmp(magic, AUDIT_LOG_MAGIC, sizeof(magic)) == 0;
+    return is_binary == binary;
+}
+
 int main(int argc, char* argv[]) {
     // Default log file if not specified
     string log_file = "system.log";
+    LogWriter::Options options;
+    bool binary = false;
     
     // Parse command line arguments
     for(int i = 1; i < argc; i++) {
@@ -14,51 +38,93 @@ int main(int argc, char* argv[]) {
         if(arg == "-f" && i + 1 < argc) {
             log_file = argv[++i];
         }
+        else if(arg == "-d" && i + 1 < argc) {
+            options.durability = string(argv[++i]) == "fsync" ? LogWriter::FSYNC : LogWriter::BUFFERED;
+        }
+        else if(arg == "-F" && i + 1 < argc) {
+            binary = string(argv[++i]) == "binary";
+        }
+        else if(arg == "-B" && i + 1 < argc) {
+            options.batch_bytes = atol(argv[++i]);
+        }
+        else if(arg == "-T" && i + 1 < argc) {
+            options.flush_interval_ms = atoi(argv[++i]);
+        }
+        else if(arg == "-R" && i + 1 < argc) {
+            // Rotation threshold in megabytes
+            options.rotate_bytes = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        }
+        else if(arg == "-I" && i + 1 < argc) {
+            // Rotation interval in seconds
+            options.rotate_interval_s = atoi(argv[++i]);
+        }
+        else if(arg == "-Z") {
+            options.compress = false;
+        }
     }
     
+    if (!log_format_matches(log_file, binary)) {
+        cerr << log_file << " is " << (binary ? "a text" : "a binary") << " log; start with -F "
+             << (binary ? "text" : "binary") << " or choose another file with -f" << endl;
+        return 1;
+    }
+
     RequestChannel channel("logging", RequestChannel::SERVER_SIDE);
-    ofstream logfile(log_file, ios::app);
+    // Every binary log file, including each rotated segment, starts with the magic
+    if (binary) {
+        options.file_header.assign(AUDIT_LOG_MAGIC, sizeof(AUDIT_LOG_MAGIC));
+    }
+    // The index learns where each record landed once its batch has been written
+    AuditIndex index(log_file, binary);
+    options.on_written = [&index](const vector<LogWriter::RecordLocation>& batch) { index.add(batch); };
+    // Records are acknowledged once queued; a background thread writes them in batches
+    LogWriter writer(log_file, options);
 
     while (true) {
         Request r = channel.receive_request(0);
 
         if (r.type == QUIT) {
+            writer.close();
             Response resp(true, 0, "", "Server shutting down");
             channel.send_response(resp);
             exit(0);
         }
 
-        logfile << "[" << r.user_id << "]: ";
-        
-        switch(r.type) {
-            case LOGIN:
-                logfile << "logged in";
-                break;
-            case LOGOUT:
-                logfile << "logged out";
-                break;
-            case DEPOSIT:
-                logfile << "deposited " << r.amount;
-                break;
-            case WITHDRAW:
-                logfile << "withdrew " << r.amount;
-                break;
-            case BALANCE:
-                logfile << "viewed balance: " << r.amount;
-                break;
-            case EARN_INTEREST: // new option
-                logfile << "accrued interest in all accounts";
-                break;
-            case UPLOAD_FILE:
-                logfile << "uploaded file: " << r.filename;
-                break;
-            case DOWNLOAD_FILE:
-                logfile << "downloaded file: " << r.filename;
-                break;
-            default:
-                logfile << "unknown action (type=" << r.type << ")";
+        if (r.type == AUDIT_QUERY && !r.oneway) {
+            // Everything acknowledged so far has to be on disk and indexed before it is queried
+            writer.flush();
+            int64_t from_us = INT64_MIN, to_us = INT64_MAX;
+            size_t comma = r.data.find(',');
+            if (comma != string::npos) {
+                if (comma > 0) {
+                    from_us = strtoll(r.data.substr(0, comma).c_str(), nullptr, 10);
+                }
+                if (comma + 1 < r.data.size()) {
+                    to_us = strtoll(r.data.substr(comma + 1).c_str(), nullptr, 10);
+                }
+            }
+            size_t limit = r.amount > 0 ? (size_t)r.amount : 1000;
+
+            vector<string> lines = index.query(r.user_id, from_us, to_us, limit);
+            stringstream history;
+            for (size_t i = 0; i < lines.size(); i++) {
+                history << (i ? "\n" : "") << lines[i];
+            }
+            Response resp(true, 0, history.str(), to_string(lines.size()) + " record(s)");
+            channel.send_response(resp);
+            continue;
+        }
+
+        int64_t now_us = audit_now_us();
+        AuditRecord record(r, now_us);
+        LogWriter::RecordKey key = {r.user_id, now_us};
+        if (binary) {
+            string encoded;
+            record.encode(encoded);
+            writer.append(encoded, &key);
+        } else {
+            writer.append(record.describe() + "\n", &key);
         }
-        logfile << endl;
 
         Response resp;
         resp.success = true;
@@ -68,6 +134,5 @@ int main(int argc, char* argv[]) {
         channel.send_response(resp);
     }
 
-    logfile.close();
     return 0;
 }
\ No newline at end of file
@@ -7,6 +7,10 @@
 #include <ctime>
 #include <algorithm>
 #include <sstream>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <pthread.h>
 
 using namespace std;
 
@@ -17,7 +21,228 @@ namespace SignalHandling {
     std::atomic<int> child_exited(0);
     
     // Server process registry
-    std::vector<ServerProcess> server_processes;
+    std::deque<ServerProcess> server_processes;
+    
+    // Write end of the pipe that reaped pids go down; -1 until child_exit_pipe is called
+    static std::atomic<int> exit_pipe_fd(-1);
+    static std::mutex exitPipeMutex;
+    
+    // Event log ring: a bounded multi-producer queue in which every slot carries a sequence
+    // number. A producer claims a slot by advancing enqueue_pos with a CAS and publishes it
+    // by bumping the slot's sequence, so it never blocks and never allocates. When the ring
+    // is full the event is counted as dropped instead of waiting for the drain thread.
+    static const size_t EVENT_SLOTS = 1024;   // power of two
+    static const size_t EVENT_TEXT = 116;
+    
+    struct EventSlot {
+        std::atomic<uint64_t> sequence; // stored relative to the slot index, see slot_sequence
+        struct timespec when;
+        uint32_t length;
+        char text[EVENT_TEXT];
+    };
+    
+    static EventSlot event_ring[EVENT_SLOTS];
+    static std::atomic<uint64_t> enqueue_pos(0);
+    static std::atomic<uint64_t> dequeue_pos(0);
+    static std::atomic<uint64_t> dropped(0);
+    static uint64_t reported_drops = 0;
+    static std::atomic<bool> drain_started(false);
+    static std::atomic<bool> draining(false);
+    static std::atomic<int> event_fd(-1);
+    
+    // Slot i starts with sequence i. Storing it minus i lets the zeroed static ring be
+    // used without an initialisation step that a handler could race with.
+    static uint64_t slot_sequence(uint64_t pos) {
+        EventSlot& slot = event_ring[pos & (EVENT_SLOTS - 1)];
+        return slot.sequence.load(std::memory_order_acquire) + (pos & (EVENT_SLOTS - 1));
+    }
+    
+    static void set_slot_sequence(uint64_t pos, uint64_t sequence) {
+        EventSlot& slot = event_ring[pos & (EVENT_SLOTS - 1)];
+        slot.sequence.store(sequence - (pos & (EVENT_SLOTS - 1)), std::memory_order_release);
+    }
+    
+    static void append_text(char* buffer, size_t size, size_t& len, const char* text) {
+        while (*text && len + 1 < size) {
+            buffer[len++] = *text++;
+        }
+    }
+    
+    static void append_number(char* buffer, size_t size, size_t& len, long value) {
+        char digits[24];
+        int n = 0;
+        bool negative = value < 0;
+        unsigned long v = negative ? -(unsigned long)value : value;
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v > 0);
+        if (negative && len + 1 < size) {
+            buffer[len++] = '-';
+        }
+        while (n > 0 && len + 1 < size) {
+            buffer[len++] = digits[--n];
+        }
+    }
+    
+    static void append_padded(char* buffer, size_t size, size_t& len, long value, int width) {
+        for (long limit = 10; width > 1; width--, limit *= 10) {
+            if (value < limit) {
+                append_text(buffer, size, len, "0");
+            }
+        }
+        append_number(buffer, size, len, value);
+    }
+    
+    // Offset of local time from UTC, taken at startup because localtime_r is not
+    // async-signal-safe. Stamps made without it ignore a DST change while running.
+    static long local_utc_offset() {
+        time_t now = time(nullptr);
+        struct tm local;
+        return localtime_r(&now, &local) ? local.tm_gmtoff : 0;
+    }
+    static const long utc_offset = local_utc_offset();
+    
+    // Formats seconds as the drain thread does, using arithmetic only (days to civil
+    // date after H. Hinnant), so it may run in a handler
+    static void append_timestamp(char* buffer, size_t size, size_t& len, time_t seconds) {
+        long t = seconds + utc_offset;
+        long days = t / 86400 - (t % 86400 < 0);
+        long secs = t - days * 86400;
+        days += 719468;
+        long era = (days >= 0 ? days : days - 146096) / 146097;
+        long doe = days - era * 146097;
+        long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        long mp = (5 * doy + 2) / 153;
+        long day = doy - (153 * mp + 2) / 5 + 1;
+        long month = mp < 10 ? mp + 3 : mp - 9;
+        long year = yoe + era * 400 + (month <= 2);
+        append_number(buffer, size, len, year);
+        append_text(buffer, size, len, "-");
+        append_padded(buffer, size, len, month, 2);
+        append_text(buffer, size, len, "-");
+        append_padded(buffer, size, len, day, 2);
+        append_text(buffer, size, len, " ");
+        append_padded(buffer, size, len, secs / 3600, 2);
+        append_text(buffer, size, len, ":");
+        append_padded(buffer, size, len, secs / 60 % 60, 2);
+        append_text(buffer, size, len, ":");
+        append_padded(buffer, size, len, secs % 60, 2);
+    }
+    
+    // Without the ring, as in a process that never calls start_event_log, an event is
+    // appended to signals.log straight away; open, write and close are async-signal-safe
+    static void write_event(const char* message) {
+        char line[48 + EVENT_TEXT];
+        size_t len = 0;
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        append_timestamp(line, sizeof(line), len, now.tv_sec);
+        append_text(line, sizeof(line), len, " - ");
+        append_text(line, sizeof(line) - 1, len, message);
+        line[len++] = '\n';
+        int fd = open("signals.log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            write(fd, line, len);
+            close(fd);
+        }
+    }
+    
+    // Writes out every published event; safe to run from more than one thread
+    static void drain_events() {
+        char buffer[16 * 1024];
+        size_t used = 0;
+        uint64_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            EventSlot& slot = event_ring[pos & (EVENT_SLOTS - 1)];
+            int64_t diff = (int64_t)(slot_sequence(pos) - (pos + 1));
+            if (diff < 0) {
+                break; // empty, or a producer has not finished publishing yet
+            }
+            if (diff > 0 || !dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+    
+            // Timestamps are taken raw in the producer and only formatted here
+            char timestamp[32];
+            struct tm local;
+            time_t seconds = slot.when.tv_sec;
+            localtime_r(&seconds, &local);
+            size_t stamp_len = strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &local);
+            size_t line_len = stamp_len + 3 + slot.length + 1;
+            if (used + line_len > sizeof(buffer)) {
+                write(event_fd, buffer, used);
+                used = 0;
+            }
+            memcpy(buffer + used, timestamp, stamp_len);
+            memcpy(buffer + used + stamp_len, " - ", 3);
+            memcpy(buffer + used + stamp_len + 3, slot.text, slot.length);
+            buffer[used + line_len - 1] = '\n';
+            used += line_len;
+    
+            set_slot_sequence(pos, pos + EVENT_SLOTS);
+            pos++;
+        }
+        if (used > 0) {
+            write(event_fd, buffer, used);
+        }
+    }
+    
+    static void drain_loop() {
+        // Handlers cannot signal a condition variable, so the ring is polled
+        while (true) {
+            draining = true;
+            drain_events();
+            draining = false;
+            uint64_t drops = dropped.load(std::memory_order_relaxed);
+            if (drops != reported_drops) {
+                char note[64];
+                size_t len = 0;
+                append_number(note, sizeof(note), len, drops - reported_drops);
+                append_text(note, sizeof(note), len, " signal events dropped, log ring full\n");
+                write(event_fd, note, len);
+                reported_drops = drops;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    
+    void start_event_log() {
+        bool expected = false;
+        if (!drain_started.compare_exchange_strong(expected, true)) {
+            return;
+        }
+        event_fd = open("signals.log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (event_fd < 0) {
+            perror("Failed to open signals.log");
+            return;
+        }
+        // Signals are left to the main thread, as for the other helper threads; the drain
+        // thread starts with them blocked so it never runs a handler
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+        std::thread(drain_loop).detach();
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        atexit(flush_event_log);
+    }
+    
+    void flush_event_log() {
+        if (event_fd < 0) {
+            return;
+        }
+        // Let the drain thread write out whatever it already took off the ring
+        for (int i = 0; i < 100 && draining; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        drain_events();
+    }
+    
+    uint64_t dropped_events() {
+        return dropped.load(std::memory_order_relaxed);
+    }
     
     void setup_handlers() {
         
@@ -49,6 +274,15 @@ namespace SignalHandling {
             exit(1);
         }
         
+        // A server that dies mid-request must surface as a failed write, not kill the client
+        sa.sa_handler = SIG_IGN;
+        sa.sa_flags = 0;
+        if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+            perror("Failed to ignore SIGPIPE");
+            exit(1);
+        }
+        
+        start_event_log();
         log_signal_event("Signal handlers initialized");
     }
     
@@ -86,13 +320,27 @@ namespace SignalHandling {
                 if (server.pid == pid) {
                     server.active = false;
                     
-                    std::stringstream ss;
-                    ss << "Child process terminated: " << server.name << " (PID: " << pid << ")";
-                    log_signal_event(ss.str());
+                    // No allocation in a handler: format into a stack buffer
+                    char message[128];
+                    size_t len = 0;
+                    append_text(message, sizeof(message), len, "Child process terminated: ");
+                    append_text(message, sizeof(message), len, server.name.c_str());
+                    append_text(message, sizeof(message), len, " (PID: ");
+                    append_number(message, sizeof(message), len, pid);
+                    append_text(message, sizeof(message), len, ")");
+                    message[len] = '\0';
+                    log_signal_event(message);
                     
                     break;
                 }
             }
+            
+            // A pid that matched nothing may be a server whose registration has not been
+            // made yet; whoever reads the pipe sees it after that
+            int fd = exit_pipe_fd.load();
+            if (fd >= 0) {
+                write(fd, &pid, sizeof(pid));
+            }
         }
     }
     
@@ -101,7 +349,7 @@ namespace SignalHandling {
         sigemptyset(&mask);
         sigaddset(&mask, SIGINT);
         
-        if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
             perror("Failed to block signals");
         } else {
             log_signal_event("Signals blocked for critical section");
@@ -113,7 +361,7 @@ namespace SignalHandling {
         sigemptyset(&mask);
         sigaddset(&mask, SIGINT);
         
-        if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1) {
+        if (pthread_sigmask(SIG_UNBLOCK, &mask, NULL) != 0) {
             perror("Failed to unblock signals");
         } else {
             log_signal_event("Signals unblocked");
@@ -131,13 +379,26 @@ namespace SignalHandling {
     }
     
     void register_server(pid_t pid, const std::string& name) {
-        server_processes.push_back({pid, name, true});
+        server_processes.emplace_back(pid, name);
         
         std::stringstream ss;
         ss << "Registered server: " << name << " (PID: " << pid << ")";
         log_signal_event(ss.str());
     }
     
+    void restart_server(const std::string& name, pid_t pid) {
+        for (auto& server : server_processes) {
+            if (server.name == name) {
+                server.pid = pid;
+                server.active = true;
+            }
+        }
+
+        std::stringstream ss;
+        ss << "Restarted server: " << name << " (PID: " << pid << ")";
+        log_signal_event(ss.str());
+    }
+    
     bool is_server_active(const std::string& name) {
         auto it = std::find_if(server_processes.begin(), server_processes.end(),
                               [&name](const ServerProcess& p) { return p.name == name; });
@@ -145,29 +406,69 @@ namespace SignalHandling {
         return (it != server_processes.end()) && it->active;
     }
     
+    pid_t server_pid(const std::string& name) {
+        for (const auto& server : server_processes) {
+            if (server.name == name) {
+                return server.pid;
+            }
+        }
+        return -1;
+    }
+    
+    int child_exit_pipe() {
+        static int fds[2] = {-1, -1};
+        std::lock_guard<std::mutex> lock(exitPipeMutex);
+        if (fds[0] < 0) {
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                perror("Failed to create child exit pipe");
+                return -1;
+            }
+            // The handler must never block, so an exit that does not fit is dropped
+            fcntl(fds[1], F_SETFL, O_NONBLOCK);
+            exit_pipe_fd = fds[1];
+        }
+        return fds[0];
+    }
+    
     void print_server_status() {
         std::cout << "\n=== Server Status ===\n";
         for (const auto& server : server_processes) {
-            std::cout << server.name << " (PID: " << server.pid << "): "
+            std::cout << server.name << " (PID: " << server.pid.load() << "): "
                       << (server.active ? "ACTIVE" : "TERMINATED") << std::endl;
         }
         std::cout << "====================\n";
     }
     
-    void log_signal_event(const std::string& message) {
-        // Get timestamp
-        time_t now = time(NULL);
-        char timestamp[64];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
-        
-        // Format log entry
-        std::string log_entry = std::string(timestamp) + " - " + message + "\n";
-        
-        // Write to log file (signal-safe)
-        int fd = open("signals.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (fd >= 0) {
-            write(fd, log_entry.c_str(), log_entry.size());
-            close(fd);
+    void log_signal_event(const char* message) {
+        if (event_fd.load() < 0) {
+            write_event(message);
+            return;
+        }
+        uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        EventSlot* slot;
+        while (true) {
+            slot = &event_ring[pos & (EVENT_SLOTS - 1)];
+            int64_t diff = (int64_t)(slot_sequence(pos) - pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed); // ring full
+                return;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
         }
+        
+        clock_gettime(CLOCK_REALTIME, &slot->when);
+        size_t len = strnlen(message, EVENT_TEXT);
+        memcpy(slot->text, message, len);
+        slot->length = len;
+        set_slot_sequence(pos, pos + 1);
+    }
+    
+    void log_signal_event(const std::string& message) {
+        log_signal_event(message.c_str());
     }
 }
\ No newline at end of file
@@ -3,8 +3,9 @@
 
 #include <signal.h>
 #include <atomic>
+#include <cstdint>
 #include <string>
-#include <vector>
+#include <deque>
 #include <sys/types.h>
 #include <iostream>
 
@@ -14,14 +15,17 @@ namespace SignalHandling {
     extern std::atomic<bool> timeout_occurred;
     extern std::atomic<int> child_exited;
     
-    // Server process tracking
+    // Server process tracking. pid and active are written by the SIGCHLD handler and by
+    // the supervisor's thread; name is fixed once registered. Entries never move.
     struct ServerProcess {
-        pid_t pid;
+        std::atomic<pid_t> pid;
         std::string name;
-        bool active;
+        std::atomic<bool> active;
+
+        ServerProcess(pid_t p, const std::string& n) : pid(p), name(n), active(true) {}
     };
     
-    extern std::vector<ServerProcess> server_processes;
+    extern std::deque<ServerProcess> server_processes;
     
     // Signal handlers
     void setup_handlers();
@@ -36,27 +40,27 @@ namespace SignalHandling {
     void cancel_timeout();
     
     // Server management
+    // Call with SIGCHLD blocked from before the fork, so the child cannot be reaped unseen
     void register_server(pid_t pid, const std::string& name);
+    // A registered server that died runs again as pid
+    void restart_server(const std::string& name, pid_t pid);
     bool is_server_active(const std::string& name);
+    pid_t server_pid(const std::string& name);
+    // From the first call on, the SIGCHLD handler also writes the pid of every child it
+    // reaps to a pipe, whose read end this returns, so a thread can wait for exits
+    int child_exit_pipe();
     void print_server_status();
     
     // Logging
+    // Events go into a lock-free ring that a background thread writes to signals.log
+    // through a file descriptor kept open for the life of the process. The const char*
+    // form is async-signal-safe; the ring is flushed at exit. Until start_event_log has
+    // run, events are written to signals.log directly instead.
+    void log_signal_event(const char* message);
     void log_signal_event(const std::string& message);
-}
-
-// Helper template for executing functions with timeout
-template<typename Func>
-bool execute_with_timeout(Func operation, int timeout_seconds) {
-    SignalHandling::timeout_occurred = false;
-    
-    // Set alarm
-    alarm(timeout_seconds);
-    
-    bool result = operation();
-    
-    // Cancel alarm
-    alarm(0);
-    return result && !SignalHandling::timeout_occurred;
+    void start_event_log();
+    void flush_event_log();
+    uint64_t dropped_events();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "supervisor.h"
+#include "signals.h"
+#include <iostream>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+using namespace std;
+
+// How long a restarted server has to open its channels before it is given up on
+static const int RECONNECT_TIMEOUT_MS = 5000;
+
+static pid_t start_process(const vector<string>& args) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        return pid;
+    }
+    if (pid == 0) { // Child process
+        vector<char*> argv;
+        for (const string& arg : args) {
+            argv.push_back((char*)arg.c_str());
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        perror(("Exec of " + args[0] + " failed").c_str());
+        _exit(1);
+    }
+    return pid;
+}
+
+pid_t spawn_server(const string& name, const vector<string>& args) {
+    // Until the server is registered, the handler would reap it without knowing whose pid it was
+    sigset_t chld, previous;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &chld, &previous);
+    pid_t pid = start_process(args);
+    if (pid > 0) {
+        SignalHandling::register_server(pid, name);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return pid;
+}
+
+Supervisor::~Supervisor() {
+    stop();
+    if (wake_fds[0] >= 0) {
+        close(wake_fds[0]);
+        close(wake_fds[1]);
+    }
+}
+
+void Supervisor::watch(const string& name, const vector<string>& args, const vector<RequestChannel*>& channels) {
+    Server server;
+    server.args = args;
+    server.channels = channels;
+    server.stats.name = name;
+    servers.push_back(server);
+}
+
+void Supervisor::start() {
+    exit_fd = SignalHandling::child_exit_pipe();
+    if (exit_fd < 0 || pipe2(wake_fds, O_CLOEXEC) < 0) {
+        perror("Supervisor not started");
+        return;
+    }
+    watcher = thread(&Supervisor::run, this);
+}
+
+void Supervisor::stop() {
+    stopping = true;
+    if (watcher.joinable()) {
+        char wake = 0;
+        write(wake_fds[1], &wake, 1);
+        watcher.join();
+    }
+}
+
+vector<Supervisor::Stats> Supervisor::get_stats() const {
+    lock_guard<mutex> lock(statsMutex);
+    vector<Stats> stats;
+    for (const Server& server : servers) {
+        stats.push_back(server.stats);
+    }
+    return stats;
+}
+
+void Supervisor::run() {
+    // Signals are left to the main thread, as for the other helper threads
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+    // A server is matched to a reaped pid here rather than in the handler, so one that
+    // died before restart() recorded its pid is still found once it has been
+    struct pollfd fds[2] = {{exit_fd, POLLIN, 0}, {wake_fds[0], POLLIN, 0}};
+    while (!stopping) {
+        if (poll(fds, 2, -1) <= 0 || !(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        pid_t pids[64];
+        ssize_t n = read(exit_fd, pids, sizeof(pids));
+        for (ssize_t i = 0; i < n / (ssize_t)sizeof(pid_t); i++) {
+            for (Server& server : servers) {
+                if (!stopping && !server.given_up && SignalHandling::server_pid(server.stats.name) == pids[i]) {
+                    restart(server);
+                }
+            }
+        }
+    }
+}
+
+void Supervisor::restart(Server& server) {
+    const string& name = server.stats.name;
+    auto died = chrono::steady_clock::now();
+    cerr << "Server " << name << " died, restarting it" << endl;
+
+    for (RequestChannel* channel : server.channels) {
+        channel->remove_pipes();
+    }
+    pid_t pid = start_process(server.args);
+    bool ok = pid > 0;
+    if (ok) {
+        SignalHandling::restart_server(name, pid);
+        for (RequestChannel* channel : server.channels) {
+            ok = ok && channel->reconnect(RECONNECT_TIMEOUT_MS);
+        }
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - died).count();
+
+    lock_guard<mutex> lock(statsMutex);
+    if (!ok) {
+        server.stats.failures++;
+        server.given_up = true;
+        SignalHandling::log_signal_event("Could not restart server " + name);
+        cerr << "Could not restart server " << name << ", giving up on it" << endl;
+        return;
+    }
+    server.stats.restarts++;
+    server.stats.last_ms = ms;
+    server.stats.total_ms += ms;
+    server.stats.max_ms = max(server.stats.max_ms, ms);
+    SignalHandling::log_signal_event("Server " + name + " recovered in " + to_string(ms) + " ms");
+    cerr << "Server " << name << " recovered in " << ms << " ms" << endl;
+}
@@ -0,0 +1,65 @@
+#ifndef _SUPERVISOR_H_
+#define _SUPERVISOR_H_
+
+#include "channel.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sys/types.h>
+
+// Forks and execs a server with args (args[0] is the program) and registers it under name
+pid_t spawn_server(const std::string& name, const std::vector<std::string>& args);
+
+/*
+*  Restarts watched servers that die. A thread waits on the pipe down which the SIGCHLD
+*  handler passes the pids it reaps. A dead server's pipes are removed, the server
+*  is started again with its original arguments, and the client channels attached to
+*  it are reopened in place, so whoever holds them carries on with the new process.
+*  Requests that were in flight when it died still fail. Servers are expected to
+*  recover their own state: finance from its account table, file from its blob store
+*  and logging from its log.
+*/
+class Supervisor {
+public:
+    struct Stats {
+        std::string name;
+        int restarts = 0;
+        int failures = 0;      // restarts whose channels could not be reopened
+        double last_ms = 0;    // time to recover: from noticing the death to reopened channels
+        double total_ms = 0;
+        double max_ms = 0;
+    };
+
+    ~Supervisor();
+
+    // channels are reopened in this order after a restart, which must be the order in
+    // which the server opens them
+    void watch(const std::string& name, const std::vector<std::string>& args,
+               const std::vector<RequestChannel*>& channels);
+    void start();
+    // Called before the servers are shut down on purpose, so they stay down
+    void stop();
+    std::vector<Stats> get_stats() const;
+
+private:
+    struct Server {
+        std::vector<std::string> args;
+        std::vector<RequestChannel*> channels;
+        bool given_up = false;
+        Stats stats;
+    };
+
+    std::vector<Server> servers;
+    std::thread watcher;
+    std::atomic<bool> stopping{false};
+    int exit_fd = -1;            // pids of reaped children, from the SIGCHLD handler
+    int wake_fds[2] = {-1, -1};  // written by stop()
+    mutable std::mutex statsMutex;
+
+    void run();
+    void restart(Server& server);
+};
+
+#endif
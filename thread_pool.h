@@ -8,6 +8,11 @@
 #include <condition_variable>
 #include <atomic>
 #include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <exception>
+#include <algorithm>
 
 class ThreadPool {
 private:
@@ -22,6 +27,87 @@ public:
     ThreadPool(size_t numThreads);
     ~ThreadPool();
     void enqueue(std::function<void()> task);
+    size_t size() const { return workers.size(); }
+
+    /*
+    *  Splits [begin, end) into chunks, runs mapper(lo, hi) -> T on each chunk in the pool
+    *  and folds the partial results with combiner(T, T) -> T in chunk order, so the result
+    *  does not depend on scheduling. Blocks the caller until every chunk is done and
+    *  rethrows the first exception thrown by mapper.
+    */
+    template<typename T, typename Mapper, typename Combiner>
+    T parallel_reduce(size_t begin, size_t end, T identity, Mapper mapper, Combiner combiner);
+
+    // Runs task() in the pool; the future yields its result or rethrows what it threw
+    template<typename F>
+    std::future<typename std::result_of<F()>::type> submit(F task);
 };
 
+template<typename F>
+std::future<typename std::result_of<F()>::type> ThreadPool::submit(F task) {
+    typedef typename std::result_of<F()>::type R;
+    auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(task));
+    std::future<R> result = packaged->get_future();
+    if (workers.empty()) {
+        (*packaged)();
+    } else {
+        enqueue([packaged] { (*packaged)(); });
+    }
+    return result;
+}
+
+template<typename T, typename Mapper, typename Combiner>
+T ThreadPool::parallel_reduce(size_t begin, size_t end, T identity, Mapper mapper, Combiner combiner) {
+    if (end <= begin) {
+        return identity;
+    }
+    if (workers.empty()) {
+        return combiner(identity, mapper(begin, end));
+    }
+
+    // A few chunks per worker keeps the threads busy when chunks take uneven time
+    size_t count = end - begin;
+    size_t chunkSize = (count + workers.size() * 4 - 1) / (workers.size() * 4);
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+    std::vector<T> partial(numChunks, identity);
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t remaining = numChunks;
+    std::exception_ptr error;
+
+    for (size_t k = 0; k < numChunks; ++k) {
+        enqueue([&, k] {
+            size_t lo = begin + k * chunkSize;
+            size_t hi = std::min(end, lo + chunkSize);
+            std::exception_ptr chunkError;
+            try {
+                partial[k] = mapper(lo, hi);
+            } catch (...) {
+                chunkError = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (chunkError && !error) {
+                error = chunkError;
+            }
+            if (--remaining == 0) {
+                doneCondition.notify_one();
+            }
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&remaining] { return remaining == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    T result = identity;
+    for (const T& value : partial) {
+        result = combiner(result, value);
+    }
+    return result;
+}
+
 #endif
\ No newline at end of file
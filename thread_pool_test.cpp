@@ -7,6 +7,8 @@
 #include <set>
 #include <chrono>
 #include <functional>
+#include <future>
+#include <stdexcept>
 #include <iomanip>
 #include <cstdlib>
 #include <unistd.h>
@@ -261,6 +263,77 @@ void test_enqueue() {
     print_test_result("ThreadPool Enqueue", test_passed);
 }
 
+// Test 4: Verify parallel_reduce covers every index once and combines in order
+void test_parallel_reduce() {
+    std::cout << "\n======== Testing ThreadPool parallel_reduce ========" << std::endl;
+
+    const size_t n = 100000;
+    ThreadPool pool(4);
+
+    std::cout << "Summing 0.." << n - 1 << " with 4 threads..." << std::endl;
+    long long sum = pool.parallel_reduce(0, n, 0LL,
+        [](size_t lo, size_t hi) {
+            long long partial = 0;
+            for (size_t i = lo; i < hi; i++) partial += i;
+            return partial;
+        },
+        [](long long a, long long b) { return a + b; });
+    long long expected = (long long)n * (n - 1) / 2;
+    std::cout << "Sum: " << sum << " (expected: " << expected << ")" << std::endl;
+
+    // Concatenating chunk bounds must give back the range in order
+    std::string order = pool.parallel_reduce(0, 50, std::string(),
+        [](size_t lo, size_t hi) {
+            std::string s;
+            for (size_t i = lo; i < hi; i++) s += std::to_string(i) + ",";
+            return s;
+        },
+        [](const std::string& a, const std::string& b) { return a + b; });
+    std::string expected_order;
+    for (size_t i = 0; i < 50; i++) expected_order += std::to_string(i) + ",";
+    bool ordered = (order == expected_order);
+    std::cout << "Chunks combined in order: " << (ordered ? "yes" : "no") << std::endl;
+
+    long long empty = pool.parallel_reduce(5, 5, 42LL,
+        [](size_t, size_t) { return 0LL; },
+        [](long long a, long long b) { return a + b; });
+    std::cout << "Empty range result: " << empty << " (expected: 42)" << std::endl;
+
+    bool test_passed = (sum == expected) && ordered && (empty == 42);
+    print_test_result("ThreadPool parallel_reduce", test_passed);
+}
+
+// Test 5: Verify submit returns each task's result and carries exceptions back
+void test_submit() {
+    std::cout << "\n======== Testing ThreadPool submit ========" << std::endl;
+
+    ThreadPool pool(4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; i++) {
+        results.push_back(pool.submit([i] {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            return i * i;
+        }));
+    }
+    bool values_ok = true;
+    for (int i = 0; i < 100; i++) {
+        values_ok = values_ok && results[i].get() == i * i;
+    }
+    std::cout << "All 100 results correct: " << (values_ok ? "yes" : "no") << std::endl;
+
+    std::future<void> failing = pool.submit([] { throw std::runtime_error("task failed"); });
+    bool rethrown = false;
+    try {
+        failing.get();
+    } catch (const std::runtime_error&) {
+        rethrown = true;
+    }
+    std::cout << "Exception rethrown from get(): " << (rethrown ? "yes" : "no") << std::endl;
+
+    bool test_passed = values_ok && rethrown;
+    print_test_result("ThreadPool submit", test_passed);
+}
+
 // Main function to run all tests
 int main() {
     SignalHandling::block_signals();
@@ -269,6 +342,8 @@ int main() {
     test_constructor();
     test_destructor();
     test_enqueue();
+    test_parallel_reduce();
+    test_submit();
     
     SignalHandling::unblock_signals();
     